@@ -16,6 +16,10 @@ void MediaServer::process()
   mRtmpServer.useSSL(mSettings.certFile, mSettings.keyFile);
   mRtmpServer.listen(mSettings.port);
 
+  if (!mMediasoupClient.openRtpSockets(mSettings.rtpSocketCount, mSettings.rtpPort)) {
+    LOG_ERROR("Failed to open rtp sockets.\n");
+  }
+
   for (auto info : mSettings.streamInfoList) {
     mMediasoupClient.createMediaProducer(info);
   }
@@ -42,20 +46,20 @@ void MediaServer::onClosed(RTMPServer *server, std::string streamKey)
 
 void MediaServer::onReceivedVideoConfig(RTMPServer *server, std::string streamKey, AVCDecoderConfigurationRecord *config)
 {
-
+  mMediasoupClient.setVideoConfig(streamKey, config);
 }
 
 void MediaServer::onReceivedAudioConfig(RTMPServer *server, std::string streamKey, AudioSpecificConfig *config)
 {
-
+  mMediasoupClient.setAudioConfig(streamKey, config);
 }
 
-void MediaServer::onReceivedVideoData(RTMPServer *server, std::string streamKey, const char *data, const uint32_t size)
+void MediaServer::onReceivedVideoData(RTMPServer *server, std::string streamKey, const H264AccessUnit *accessUnit)
 {
-  mMediasoupClient.sendVideoData(streamKey, data, size);
+  mMediasoupClient.sendVideoData(streamKey, accessUnit);
 }
 
-void MediaServer::onReceivedAudioData(RTMPServer *server, std::string streamKey, const char *data, const uint32_t size)
+void MediaServer::onReceivedAudioData(RTMPServer *server, std::string streamKey, const char *data, const uint32_t size, uint32_t timestamp)
 {
-  mMediasoupClient.sendAudioData(streamKey, data, size);
+  mMediasoupClient.sendAudioData(streamKey, data, size, timestamp);
 }
@@ -21,6 +21,6 @@ public:
   virtual void onClosed(RTMPServer *server, std::string streamKey) override;
   virtual void onReceivedVideoConfig(RTMPServer *server, std::string streamKey, AVCDecoderConfigurationRecord *config) override;
   virtual void onReceivedAudioConfig(RTMPServer *server, std::string streamKey, AudioSpecificConfig *config) override;
-  virtual void onReceivedVideoData(RTMPServer *server, std::string streamKey, const char *data, const uint32_t size) override;
-  virtual void onReceivedAudioData(RTMPServer *server, std::string streamKey, const char *data, const uint32_t size) override;
+  virtual void onReceivedVideoData(RTMPServer *server, std::string streamKey, const H264AccessUnit *accessUnit) override;
+  virtual void onReceivedAudioData(RTMPServer *server, std::string streamKey, const char *data, const uint32_t size, uint32_t timestamp) override;
 };
@@ -1,6 +1,7 @@
 #include "Settings.h"
 #include <fstream>
 #include <iostream>
+#include <sstream>
 #include <nlohmann/json.hpp>
 
 using json = nlohmann::json;
@@ -14,6 +15,8 @@ void SettingsLoader::load(std::string& filePath, Settings *settings)
   settings->port = 1935;
   settings->ws = "ws://mediasoup:3000";
   settings->origin = "localhost";
+  settings->rtpSocketCount = 1;
+  settings->rtpPort = 0;
 
   if (j.find("rtmp-server") != j.end()) {
     auto rtmpserver = j["rtmp-server"];
@@ -39,6 +42,17 @@ void SettingsLoader::load(std::string& filePath, Settings *settings)
     }
   }
 
+  if (j.find("rtp") != j.end()) {
+    auto rtp = j["rtp"];
+    if (rtp.find("sockets") != rtp.end()) {
+      settings->rtpSocketCount = rtp["sockets"].get<int>();
+    }
+    if (rtp.find("port") != rtp.end()) {
+      settings->rtpPort = rtp["port"].get<int>();
+    }
+    loadRTPInfo(rtp, &settings->rtpInfo);
+  }
+
   if (j.find("streamers") != j.end()) {
     auto streamers = j["streamers"];
     for (json::iterator it = streamers.begin(); it != streamers.end(); ++it) {
@@ -47,6 +61,12 @@ void SettingsLoader::load(std::string& filePath, Settings *settings)
       if (streamer.find("streamKey") != streamer.end()) {
         info->streamKey = streamer["streamKey"].get<std::string>();
 
+        info->rtpInfo = settings->rtpInfo;
+        if (streamer.find("rtp") != streamer.end()) {
+          auto rtp = streamer["rtp"];
+          loadRTPInfo(rtp, &info->rtpInfo);
+        }
+
         if (streamer.find("video") != streamer.end()) {
           auto video = streamer["video"];
           if (video.find("codec") != video.end()) {
@@ -55,6 +75,9 @@ void SettingsLoader::load(std::string& filePath, Settings *settings)
             info->videoInfo.codec.mimeType = codec["mimeType"].get<std::string>();
             info->videoInfo.codec.payloadType = codec["payloadType"].get<int>();
             info->videoInfo.codec.clockRate = codec["clockRate"].get<int>();
+            if (codec.find("rtxPayloadType") != codec.end()) {
+              info->videoInfo.codec.rtxPayloadType = codec["rtxPayloadType"].get<int>();
+            }
           }
         }
 
@@ -69,7 +92,76 @@ void SettingsLoader::load(std::string& filePath, Settings *settings)
             info->audioInfo.codec.channels = codec["channels"].get<int>();
             if (codec.find("parameters") != codec.end()) {
               auto parameters = codec["parameters"];
-              info->audioInfo.codec.stereo = parameters["sprop-stereo"].get<int>();
+              if (parameters.find("sprop-stereo") != parameters.end()) {
+                info->audioInfo.codec.stereo = parameters["sprop-stereo"].get<int>();
+              }
+              if (parameters.find("num_streams") != parameters.end()) {
+                info->audioInfo.codec.numStreams = parameters["num_streams"].get<int>();
+              }
+              if (parameters.find("coupled_streams") != parameters.end()) {
+                info->audioInfo.codec.coupledStreams = parameters["coupled_streams"].get<int>();
+              }
+              if (parameters.find("channel_mapping") != parameters.end()) {
+                // "0,4,1,2,3,5" の形式です。
+                std::stringstream ss(parameters["channel_mapping"].get<std::string>());
+                std::string index;
+                while (std::getline(ss, index, ',')) {
+                  info->audioInfo.codec.channelMapping.push_back(std::stoi(index));
+                }
+              }
+            }
+            if (info->audioInfo.codec.mimeType.compare("audio/multiopus") == 0 &&
+                (info->audioInfo.codec.numStreams <= 0 ||
+                 (int)info->audioInfo.codec.channelMapping.size() != info->audioInfo.codec.channels)) {
+              LOG_WARN("Invalid multiopus parameters. channels=%d num_streams=%d channel_mapping=%d\n",
+                  info->audioInfo.codec.channels, info->audioInfo.codec.numStreams,
+                  (int)info->audioInfo.codec.channelMapping.size());
+            }
+          }
+          if (audio.find("encoder") != audio.end()) {
+            auto encoder = audio["encoder"];
+            if (encoder.find("bitrate") != encoder.end()) {
+              info->audioInfo.encoder.bitrate = encoder["bitrate"].get<int>();
+            }
+            if (encoder.find("fec") != encoder.end()) {
+              info->audioInfo.encoder.fec = encoder["fec"].get<bool>();
+            }
+            if (encoder.find("packetLossPerc") != encoder.end()) {
+              info->audioInfo.encoder.packetLossPerc = encoder["packetLossPerc"].get<int>();
+            }
+            if (encoder.find("adaptive") != encoder.end()) {
+              info->audioInfo.encoder.adaptive = encoder["adaptive"].get<bool>();
+            }
+            if (encoder.find("maxBitrate") != encoder.end()) {
+              info->audioInfo.encoder.maxBitrate = encoder["maxBitrate"].get<int>();
+            }
+            if (encoder.find("frameDuration") != encoder.end()) {
+              info->audioInfo.encoder.frameDuration = encoder["frameDuration"].get<int>();
+            }
+            if (encoder.find("framesPerPacket") != encoder.end()) {
+              info->audioInfo.encoder.framesPerPacket = encoder["framesPerPacket"].get<int>();
+            }
+            validateAudioFrameDuration(info->audioInfo.encoder);
+            if (encoder.find("driftCompensation") != encoder.end()) {
+              info->audioInfo.encoder.driftCompensation = encoder["driftCompensation"].get<bool>();
+            }
+            if (encoder.find("onDemand") != encoder.end()) {
+              info->audioInfo.encoder.onDemand = encoder["onDemand"].get<bool>();
+            }
+            if (encoder.find("dtx") != encoder.end()) {
+              auto dtx = encoder["dtx"];
+              if (dtx.find("enabled") != dtx.end()) {
+                info->audioInfo.encoder.dtx = dtx["enabled"].get<bool>();
+              }
+              if (dtx.find("threshold") != dtx.end()) {
+                info->audioInfo.encoder.dtxThreshold = dtx["threshold"].get<double>();
+              }
+              if (dtx.find("hangover") != dtx.end()) {
+                info->audioInfo.encoder.dtxHangover = dtx["hangover"].get<int>();
+              }
+              if (dtx.find("keepAlive") != dtx.end()) {
+                info->audioInfo.encoder.dtxKeepAlive = dtx["keepAlive"].get<int>();
+              }
             }
           }
         }
@@ -80,6 +172,91 @@ void SettingsLoader::load(std::string& filePath, Settings *settings)
   }
 }
 
+void SettingsLoader::loadRTPInfo(json& rtp, RTPInfo *info)
+{
+  if (rtp.find("batchSize") != rtp.end()) {
+    info->batchSize = rtp["batchSize"].get<int>();
+  }
+  if (rtp.find("gso") != rtp.end()) {
+    info->gso = rtp["gso"].get<bool>();
+  }
+  if (rtp.find("rtcpMux") != rtp.end()) {
+    info->rtcpMux = rtp["rtcpMux"].get<bool>();
+  }
+  if (rtp.find("headerExtensions") != rtp.end()) {
+    info->headerExtensions = rtp["headerExtensions"].get<bool>();
+  }
+  if (rtp.find("frameMarking") != rtp.end()) {
+    info->frameMarking = rtp["frameMarking"].get<bool>();
+  }
+  if (rtp.find("pacing") != rtp.end()) {
+    auto pacing = rtp["pacing"];
+    if (pacing.find("enabled") != pacing.end()) {
+      info->pacing = pacing["enabled"].get<bool>();
+    }
+    if (pacing.find("multiplier") != pacing.end()) {
+      info->pacingMultiplier = pacing["multiplier"].get<double>();
+    }
+    if (pacing.find("minBitrate") != pacing.end()) {
+      info->pacingMinBitrate = pacing["minBitrate"].get<int>();
+    }
+    if (pacing.find("maxDelay") != pacing.end()) {
+      info->pacingMaxDelay = pacing["maxDelay"].get<int>();
+    }
+  }
+  if (rtp.find("nack") != rtp.end()) {
+    auto nack = rtp["nack"];
+    if (nack.find("enabled") != nack.end()) {
+      info->nack = nack["enabled"].get<bool>();
+    }
+    if (nack.find("maxAge") != nack.end()) {
+      info->nackMaxAge = nack["maxAge"].get<int>();
+    }
+    if (nack.find("maxBitrate") != nack.end()) {
+      info->nackMaxBitrate = nack["maxBitrate"].get<int>();
+    }
+  }
+  if (rtp.find("gopCache") != rtp.end()) {
+    auto gopCache = rtp["gopCache"];
+    if (gopCache.find("enabled") != gopCache.end()) {
+      info->gopCache = gopCache["enabled"].get<bool>();
+    }
+    if (gopCache.find("maxBytes") != gopCache.end()) {
+      info->gopCacheMaxBytes = gopCache["maxBytes"].get<int>();
+    }
+    if (gopCache.find("minInterval") != gopCache.end()) {
+      info->gopCacheMinInterval = gopCache["minInterval"].get<int>();
+    }
+  }
+  if (rtp.find("congestionControl") != rtp.end()) {
+    auto congestionControl = rtp["congestionControl"];
+    if (congestionControl.find("enabled") != congestionControl.end()) {
+      info->congestionControl = congestionControl["enabled"].get<bool>();
+    }
+    if (congestionControl.find("minBitrate") != congestionControl.end()) {
+      info->congestionControlMinBitrate = congestionControl["minBitrate"].get<int>();
+    }
+    if (congestionControl.find("maxBitrate") != congestionControl.end()) {
+      info->congestionControlMaxBitrate = congestionControl["maxBitrate"].get<int>();
+    }
+  }
+}
+
+// Opus で使用できないフレーム長とフレーム数は、使用できる値に直します。
+void SettingsLoader::validateAudioFrameDuration(AudioEncoderInfo& encoder)
+{
+  int duration = encoder.frameDuration;
+  if (duration != 10 && duration != 20 && duration != 40 && duration != 60) {
+    LOG_WARN("Unsupported opus frame duration. frameDuration=%d\n", duration);
+    encoder.frameDuration = 20;
+  }
+  // RFC 6716 で 1 パケットに含められるのは 120 ミリ秒までです。
+  int maxFrames = 120 / encoder.frameDuration;
+  if (encoder.framesPerPacket < 1 || encoder.framesPerPacket > maxFrames) {
+    LOG_WARN("Unsupported opus frames per packet. framesPerPacket=%d\n", encoder.framesPerPacket);
+    encoder.framesPerPacket = (encoder.framesPerPacket < 1) ? 1 : maxFrames;
+  }
+}
 
 void SettingsLoader::print(Settings *settings)
 {
@@ -89,9 +266,29 @@ void SettingsLoader::print(Settings *settings)
   LOG_INFO("origin: %s\n", settings->origin.c_str());
   LOG_INFO("------------------------------------\n");
   LOG_INFO("RTMP Port: %d\n", settings->port);
+  LOG_INFO("RTP sockets: %d port: %d\n", settings->rtpSocketCount, settings->rtpPort);
+  LOG_INFO("RTP batchSize: %d\n", settings->rtpInfo.batchSize);
+  LOG_INFO("RTP gso: %s\n", settings->rtpInfo.gso ? "true" : "false");
+  LOG_INFO("RTP rtcpMux: %s\n", settings->rtpInfo.rtcpMux ? "true" : "false");
+  LOG_INFO("RTP headerExtensions: %s\n", settings->rtpInfo.headerExtensions ? "true" : "false");
+  LOG_INFO("RTP frameMarking: %s\n", settings->rtpInfo.frameMarking ? "true" : "false");
+  LOG_INFO("RTP pacing: %s multiplier: %.2f minBitrate: %d maxDelay: %d\n",
+      settings->rtpInfo.pacing ? "true" : "false", settings->rtpInfo.pacingMultiplier,
+      settings->rtpInfo.pacingMinBitrate, settings->rtpInfo.pacingMaxDelay);
+  LOG_INFO("RTP nack: %s maxAge: %d maxBitrate: %d\n",
+      settings->rtpInfo.nack ? "true" : "false", settings->rtpInfo.nackMaxAge, settings->rtpInfo.nackMaxBitrate);
+  LOG_INFO("RTP gopCache: %s maxBytes: %d minInterval: %d\n",
+      settings->rtpInfo.gopCache ? "true" : "false", settings->rtpInfo.gopCacheMaxBytes, settings->rtpInfo.gopCacheMinInterval);
+  LOG_INFO("RTP congestionControl: %s minBitrate: %d maxBitrate: %d\n",
+      settings->rtpInfo.congestionControl ? "true" : "false",
+      settings->rtpInfo.congestionControlMinBitrate, settings->rtpInfo.congestionControlMaxBitrate);
   LOG_INFO("StreamKey:\n");
   for (auto info : settings->streamInfoList) {
     LOG_INFO("  - %s\n", info->streamKey.c_str());
+    LOG_INFO("    audio frameDuration: %d framesPerPacket: %d\n",
+        info->audioInfo.encoder.frameDuration, info->audioInfo.encoder.framesPerPacket);
+    LOG_INFO("    audio driftCompensation: %s onDemand: %s\n",
+        info->audioInfo.encoder.driftCompensation ? "true" : "false", info->audioInfo.encoder.onDemand ? "true" : "false");
   }
   LOG_INFO("------------------------------------\n");
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include <memory>
 #include <string>
 #include <vector>
+#include <nlohmann/json.hpp>
 
 #include "StreamInfo.h"
 #include "utils/Log.h"
@@ -20,6 +21,13 @@ public:
   std::string ws;
   std::string origin;
 
+  // RTP 送信用ソケットの数 (0 の場合は CPU のコア数) とポート番号 (0 の場合は自動)
+  int rtpSocketCount;
+  int rtpPort;
+
+  // RTP 送信の設定 (streamers に指定がない場合のデフォルト値)
+  RTPInfo rtpInfo;
+
   std::vector<std::shared_ptr<StreamInfo>> streamInfoList;
 };
 
@@ -28,6 +36,9 @@ private:
   SettingsLoader() {}
   ~SettingsLoader() {}
 
+  static void loadRTPInfo(nlohmann::json& rtp, RTPInfo *info);
+  static void validateAudioFrameDuration(AudioEncoderInfo& encoder);
+
 public:
   static void load(std::string& filePath, Settings *settings);
   static void print(Settings *settings);
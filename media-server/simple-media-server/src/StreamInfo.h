@@ -1,12 +1,15 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 class VideoCodecInfo {
 public:
   std::string mimeType;
   int payloadType;
   int clockRate;
+  // RTX の payload type (0 の場合には RTX を使用しません)
+  int rtxPayloadType = 0;
 };
 
 
@@ -24,6 +27,44 @@ public:
   int clockRate;
   int channels;
   int stereo;
+  // audio/multiopus の場合のマルチストリームの設定 (RFC 7845 のチャンネルマッピング)
+  int numStreams = 0;
+  int coupledStreams = 0;
+  std::vector<int> channelMapping;
+};
+
+
+// AAC から変換する時の Opus エンコーダの設定
+class AudioEncoderInfo {
+public:
+  // ビットレート (bps)
+  int bitrate = 64000;
+  // in-band FEC を使用するか
+  bool fec = true;
+  // エンコーダに設定するパケットロス率 (%)
+  // adaptive の場合には、RTCP RR のパケットロス率に対する下限になります。
+  int packetLossPerc = 0;
+  // RTCP RR のパケットロス率に合わせて FEC、パケットロス率、ビットレートを調整するか
+  bool adaptive = true;
+  // adaptive の場合に FEC のためにビットレートを上げる上限 (bps)
+  int maxBitrate = 96000;
+  // 1 フレームの長さ (ミリ秒): 10, 20, 40, 60
+  int frameDuration = 20;
+  // 1 パケットにまとめるフレーム数 (1 パケットは 120 ミリ秒まで)
+  int framesPerPacket = 1;
+  // 配信側の音声のクロックのずれを、リサンプラーの変換比を調整して補正するか
+  bool driftCompensation = false;
+  // consumer がいない間は、変換と送信を止めるか
+  // mediasoup から consumer の数が通知される場合にだけ有効にしてください。
+  bool onDemand = false;
+  // 無音の間は送信を止めるか (DTX)
+  bool dtx = false;
+  // 無音とみなすレベル (dBFS)
+  double dtxThreshold = -60.0;
+  // レベルが閾値を下回ってから送信を止めるまでの時間 (ミリ秒)
+  int dtxHangover = 200;
+  // 無音の間に送信する間隔 (ミリ秒)
+  int dtxKeepAlive = 400;
 };
 
 
@@ -31,12 +72,54 @@ class AudioInfo {
 public:
   bool enabled;
   AudioCodecInfo codec;
+  AudioEncoderInfo encoder;
+};
+
+
+class RTPInfo {
+public:
+  // sendmmsg で一度に送信する最大パケット数
+  int batchSize = 32;
+  // UDP GSO (UDP_SEGMENT) を使用するか
+  bool gso = true;
+  // RTP と RTCP を同じポートで送受信するか (rtcp-mux)
+  bool rtcpMux = true;
+  // mid、abs-send-time、transport-wide-cc の拡張ヘッダーを付加するか
+  bool headerExtensions = true;
+  // 映像のフレームの時間方向のレイヤーを frame-marking の拡張ヘッダーで通知するか
+  bool frameMarking = true;
+  // 映像のペーシングを行うか
+  bool pacing = true;
+  // 計測したビットレートに対するペーシングの送信レートの倍率
+  double pacingMultiplier = 2.5;
+  // ペーシングの送信レートの下限 (bps)
+  int pacingMinBitrate = 1000000;
+  // ペーサーのキューにパケットを保持する最大時間 (ミリ秒)
+  int pacingMaxDelay = 5;
+  // NACK による映像の再送を行うか
+  bool nack = true;
+  // 再送するパケットの最大経過時間 (ミリ秒)
+  int nackMaxAge = 1000;
+  // 再送に使用する最大ビットレート (bps)
+  int nackMaxBitrate = 2000000;
+  // PLI/FIR を受信した時に GOP キャッシュを送信し直すか
+  bool gopCache = true;
+  // GOP キャッシュの最大バイト数
+  int gopCacheMaxBytes = 8 * 1024 * 1024;
+  // GOP キャッシュを送信し直す最小間隔 (ミリ秒)
+  int gopCacheMinInterval = 1000;
+  // transport-cc のフィードバックで帯域を推定して、足りない場合には映像のフレームを間引くか
+  bool congestionControl = true;
+  // 推定ビットレートの下限と上限 (bps)
+  int congestionControlMinBitrate = 100000;
+  int congestionControlMaxBitrate = 20000000;
 };
 
 
 class StreamInfo {
 public:
   std::string streamKey;
+  RTPInfo rtpInfo;
   VideoInfo videoInfo;
   AudioInfo audioInfo;
 };
@@ -4,6 +4,7 @@
 SimpleAACDecoder::SimpleAACDecoder()
 {
   mDecoder = nullptr;
+  mDecodeFlags = 0;
 }
 
 SimpleAACDecoder::~SimpleAACDecoder()
@@ -78,7 +79,8 @@ int32_t SimpleAACDecoder::decode(int16_t *outBuffer, uint32_t outBufferSize)
   }
 
   INT_PCM *outPCM = (INT_PCM *)outBuffer;
-  if (aacDecoder_DecodeFrame(mDecoder, outPCM, outBufferSize, 0) == AAC_DEC_OK) {
+  if (aacDecoder_DecodeFrame(mDecoder, outPCM, outBufferSize, mDecodeFlags) == AAC_DEC_OK) {
+    mDecodeFlags = 0;
     CStreamInfo *info = aacDecoder_GetStreamInfo(mDecoder);
     if (info) {
       return info->numChannels * info->frameSize;
@@ -86,3 +88,28 @@ int32_t SimpleAACDecoder::decode(int16_t *outBuffer, uint32_t outBufferSize)
   }
   return -1;
 }
+
+uint8_t SimpleAACDecoder::getChannels()
+{
+  if (!mDecoder) {
+    return 0;
+  }
+
+  CStreamInfo *info = aacDecoder_GetStreamInfo(mDecoder);
+  return info ? info->numChannels : 0;
+}
+
+uint32_t SimpleAACDecoder::getSampleRate()
+{
+  if (!mDecoder) {
+    return 0;
+  }
+
+  CStreamInfo *info = aacDecoder_GetStreamInfo(mDecoder);
+  return (info && info->sampleRate > 0) ? info->sampleRate : 0;
+}
+
+void SimpleAACDecoder::clearHistory()
+{
+  mDecodeFlags = AACDEC_CLRHIST | AACDEC_INTR;
+}
@@ -8,6 +8,8 @@
 class SimpleAACDecoder {
 private:
   HANDLE_AACDECODER mDecoder;
+  // 次の aacDecoder_DecodeFrame に指定するフラグ
+  UINT mDecodeFlags;
 
 public:
   SimpleAACDecoder();
@@ -17,5 +19,11 @@ public:
   void initRaw(const uint8_t *ascData, uint32_t ascDataLen);
   int32_t fillData(const uint8_t *inBuffer, uint32_t inBufferSize);
   int32_t decode(int16_t *outBuffer, uint32_t outBufferSize);
+  // 最後にデコードしたフレームのチャンネル数
+  uint8_t getChannels();
+  // 最後にデコードしたフレームのサンプリング周波数 (SBR を含む場合には SBR の出力の周波数)
+  uint32_t getSampleRate();
+  // 入力が途切れた後に、前のフレームの残りと混ざらないように、次のデコードで内部の履歴を消去します。
+  void clearHistory();
   void destroy();
 };
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+// アクセスユニットに含まれる NAL ユニット
+// data は受信した RTMP パケットのバッファを直接参照しています。
+class H264NalUnit {
+public:
+  const char *data;
+  uint32_t size;
+};
+
+// RTMP の 1 つのビデオメッセージに含まれる NAL ユニットをまとめたものです。
+// RTMP では 1 つのビデオメッセージに 1 フレーム分の NAL ユニットが格納されています。
+class H264AccessUnit {
+public:
+  std::vector<H264NalUnit> nalUnits;
+  // デコードタイムスタンプ (ミリ秒)
+  uint32_t dts = 0;
+  // CompositionTime (ミリ秒)
+  // 表示タイムスタンプは dts + compositionTime になります。
+  int32_t compositionTime = 0;
+  // FLV の FrameType
+  int frameType = 0;
+  bool keyframe = false;
+
+  // IDR スライスを含んでいるか
+  bool hasIdr() const {
+    for (auto& nalUnit : nalUnits) {
+      if ((nalUnit.data[0] & 0x1F) == 5) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // 他のフレームから参照されるスライスを含んでいるか (nal_ref_idc が 0 以外)
+  bool isReference() const {
+    for (auto& nalUnit : nalUnits) {
+      unsigned char naluType = nalUnit.data[0] & 0x1F;
+      if (naluType >= 1 && naluType <= 5 && (nalUnit.data[0] & 0x60) != 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // 他のフレームから参照されず、捨ててもデコードできるフレームか
+  // nal_ref_idc が 0 の場合か、FLV の FrameType が disposable inter frame (3) の場合です。
+  bool isDiscardable() const {
+    if (hasIdr()) {
+      return false;
+    }
+    return frameType == 3 || !isReference();
+  }
+
+  // NAL ユニットの合計サイズ
+  uint32_t getSize() const {
+    uint32_t size = 0;
+    for (auto& nalUnit : nalUnits) {
+      size += nalUnit.size;
+    }
+    return size;
+  }
+
+  void clear() {
+    nalUnits.clear();
+    dts = 0;
+    compositionTime = 0;
+    frameType = 0;
+    keyframe = false;
+  }
+};
@@ -4,7 +4,11 @@
 SimpleOpusEncoder::SimpleOpusEncoder()
 {
   mEncoder = nullptr;
+  mMSEncoder = nullptr;
   mBitrate = 64000;
+  mInbandFec = false;
+  mPacketLossPerc = 0;
+  mDtx = false;
 }
 
 SimpleOpusEncoder::~SimpleOpusEncoder()
@@ -16,7 +20,7 @@ void SimpleOpusEncoder::initialize(uint32_t sampleRate, uint8_t channels)
 {
   int err;
 
-  if (mEncoder) {
+  if (mEncoder || mMSEncoder) {
     LOG_ERROR("SimpleOpusEncoder has already been initialized.\n");
     return;
   }
@@ -27,14 +31,69 @@ void SimpleOpusEncoder::initialize(uint32_t sampleRate, uint8_t channels)
   mEncoder = opus_encoder_create(sampleRate, channels, OPUS_APPLICATION_AUDIO, &err);
   if (err < 0) {
     LOG_ERROR("Failed to create an opus encoder: %s\n", opus_strerror(err));
+    mEncoder = nullptr;
     return;
   }
+  configure();
+}
 
-  err = opus_encoder_ctl(mEncoder, OPUS_SET_BITRATE(mBitrate));
+void SimpleOpusEncoder::initializeMultistream(uint32_t sampleRate, uint8_t channels, int streams, int coupledStreams, const uint8_t *mapping)
+{
+  int err;
+
+  if (mEncoder || mMSEncoder) {
+    LOG_ERROR("SimpleOpusEncoder has already been initialized.\n");
+    return;
+  }
+
+  mSampleRate = sampleRate;
+  mChannels = channels;
+
+  mMSEncoder = opus_multistream_encoder_create(sampleRate, channels, streams, coupledStreams, mapping, OPUS_APPLICATION_AUDIO, &err);
+  if (err < 0) {
+    LOG_ERROR("Failed to create an opus multistream encoder: %s\n", opus_strerror(err));
+    mMSEncoder = nullptr;
+    return;
+  }
+  configure();
+}
+
+void SimpleOpusEncoder::configure()
+{
+  int err = ctl(OPUS_SET_BITRATE(mBitrate));
   if (err < 0) {
     LOG_ERROR("Failed to set bitrate to opus encoder: %s\n", opus_strerror(err));
     return;
   }
+
+  err = ctl(OPUS_SET_INBAND_FEC(mInbandFec ? 1 : 0));
+  if (err < 0) {
+    LOG_ERROR("Failed to set inband fec to opus encoder: %s\n", opus_strerror(err));
+    return;
+  }
+
+  err = ctl(OPUS_SET_PACKET_LOSS_PERC(mPacketLossPerc));
+  if (err < 0) {
+    LOG_ERROR("Failed to set packet loss perc to opus encoder: %s\n", opus_strerror(err));
+    return;
+  }
+
+  err = ctl(OPUS_SET_DTX(mDtx ? 1 : 0));
+  if (err < 0) {
+    LOG_ERROR("Failed to set dtx to opus encoder: %s\n", opus_strerror(err));
+    return;
+  }
+}
+
+// 作成したエンコーダの種類に合わせて ctl を呼び出します。
+int SimpleOpusEncoder::ctl(int request, opus_int32 value)
+{
+  if (mMSEncoder) {
+    return opus_multistream_encoder_ctl(mMSEncoder, request, value);
+  } else if (mEncoder) {
+    return opus_encoder_ctl(mEncoder, request, value);
+  }
+  return OPUS_OK;
 }
 
 void SimpleOpusEncoder::destroy()
@@ -43,14 +102,27 @@ void SimpleOpusEncoder::destroy()
     opus_encoder_destroy(mEncoder);
     mEncoder = nullptr;
   }
+  if (mMSEncoder) {
+    opus_multistream_encoder_destroy(mMSEncoder);
+    mMSEncoder = nullptr;
+  }
+}
+
+void SimpleOpusEncoder::reset()
+{
+  if (mMSEncoder) {
+    opus_multistream_encoder_ctl(mMSEncoder, OPUS_RESET_STATE);
+  } else if (mEncoder) {
+    opus_encoder_ctl(mEncoder, OPUS_RESET_STATE);
+  }
 }
 
 void SimpleOpusEncoder::setBitrate(uint32_t bitrate)
 {
   mBitrate = bitrate;
 
-  if (mEncoder) {
-    int err = opus_encoder_ctl(mEncoder, OPUS_SET_BITRATE(bitrate));
+  if (mEncoder || mMSEncoder) {
+    int err = ctl(OPUS_SET_BITRATE(bitrate));
     if (err < 0) {
       LOG_ERROR("Failed to set bitrate to opus encoder: %s\n", opus_strerror(err));
       return;
@@ -58,14 +130,58 @@ void SimpleOpusEncoder::setBitrate(uint32_t bitrate)
   }
 }
 
+void SimpleOpusEncoder::setInbandFec(bool enabled)
+{
+  mInbandFec = enabled;
+
+  if (mEncoder || mMSEncoder) {
+    int err = ctl(OPUS_SET_INBAND_FEC(enabled ? 1 : 0));
+    if (err < 0) {
+      LOG_ERROR("Failed to set inband fec to opus encoder: %s\n", opus_strerror(err));
+      return;
+    }
+  }
+}
+
+void SimpleOpusEncoder::setPacketLossPerc(int perc)
+{
+  mPacketLossPerc = perc;
+
+  if (mEncoder || mMSEncoder) {
+    int err = ctl(OPUS_SET_PACKET_LOSS_PERC(perc));
+    if (err < 0) {
+      LOG_ERROR("Failed to set packet loss perc to opus encoder: %s\n", opus_strerror(err));
+      return;
+    }
+  }
+}
+
+void SimpleOpusEncoder::setDtx(bool enabled)
+{
+  mDtx = enabled;
+
+  if (mEncoder || mMSEncoder) {
+    int err = ctl(OPUS_SET_DTX(enabled ? 1 : 0));
+    if (err < 0) {
+      LOG_ERROR("Failed to set dtx to opus encoder: %s\n", opus_strerror(err));
+      return;
+    }
+  }
+}
+
 int32_t SimpleOpusEncoder::encode(opus_int16 *inFrame, uint32_t inFrameSize, uint8_t *outBuffer, uint32_t maxOutBufferSize)
 {
-  if (!mEncoder) {
+  if (!mEncoder && !mMSEncoder) {
     LOG_ERROR("SimpleOpusEncoder is not initialized.\n");
     return -1;
   }
 
-  int32_t nbBytes = opus_encode(mEncoder, inFrame, inFrameSize, outBuffer, maxOutBufferSize);
+  int32_t nbBytes;
+  if (mMSEncoder) {
+    nbBytes = opus_multistream_encode(mMSEncoder, inFrame, inFrameSize, outBuffer, maxOutBufferSize);
+  } else {
+    nbBytes = opus_encode(mEncoder, inFrame, inFrameSize, outBuffer, maxOutBufferSize);
+  }
   if (nbBytes < 0) {
     LOG_ERROR("opus encode failed: %s\n", opus_strerror(nbBytes));
     return -1;
@@ -2,20 +2,42 @@
 
 #include <stdint.h>
 #include <opus/opus.h>
+#include <opus/opus_multistream.h>
 
 class SimpleOpusEncoder {
 private:
   OpusEncoder *mEncoder;
+  // 3 チャンネル以上の場合のマルチストリームのエンコーダ
+  OpusMSEncoder *mMSEncoder;
   uint32_t mBitrate;
+  bool mInbandFec;
+  int mPacketLossPerc;
+  bool mDtx;
   uint32_t mSampleRate;
   uint8_t mChannels;
 
+  void configure();
+  int ctl(int request, opus_int32 value);
+
 public:
   SimpleOpusEncoder();
   virtual ~SimpleOpusEncoder();
 
   void initialize(uint32_t sampleRate, uint8_t channels);
+  // マルチストリーム (RFC 7845 のチャンネルマッピング) で初期化します。
+  // streams、coupledStreams、mapping は SDP の num_streams、coupled_streams、channel_mapping と同じものを指定します。
+  void initializeMultistream(uint32_t sampleRate, uint8_t channels, int streams, int coupledStreams, const uint8_t *mapping);
+  // エンコーダの内部状態を初期化します。設定は保持されます。
+  void reset();
   void setBitrate(uint32_t bitrate);
+  // in-band FEC を使用するか
+  void setInbandFec(bool enabled);
+  // 想定するパケットロス率 (0 - 100 %)
+  // FEC に割り当てるビット量は、この値に合わせてエンコーダが決めます。
+  void setPacketLossPerc(int perc);
+  // DTX を使用するか
+  // 有効な場合には、無音のフレームは 2 バイト以下のパケットになります。
+  void setDtx(bool enabled);
   int32_t encode(opus_int16 *inFrame, uint32_t inFrameSize, uint8_t *outBuffer, uint32_t maxOutBufferSize);
   void destroy();
 };
\ No newline at end of file
@@ -1,11 +1,24 @@
+#include <math.h>
 #include "MediaProducer.h"
-#include "../rtp/H264RTPSender.h"
-#include "../rtp/OpusRTPSender.h"
 
-MediaProducer::MediaProducer(std::shared_ptr<StreamInfo> info) : info(info)
+// Opus のエンコード結果を格納するバッファのサイズ
+#define OPUS_ENCODE_BUFFER_SIZE (20 * 1024)
+// パケットロス率に合わせてビットレートを上げる時に、パケットロス率として考慮する上限 (%)
+#define OPUS_FEC_MAX_LOSS_PERC 25
+
+MediaProducer::MediaProducer(std::shared_ptr<StreamInfo> info, std::shared_ptr<RTPSocket> socket) : mSocket(socket), info(info)
 {
   mVideoSender = nullptr;
   mAudioSender = nullptr;
+  mClock = std::make_shared<MediaClock>();
+  mAudioConfigured = false;
+  mAudioReportCount = 0;
+  mAudioLossRate = 0;
+  mAudioBitrate = -1;
+  mAudioFec = false;
+  mAudioPacketLossPerc = -1;
+  mAudioAnchorId = 0;
+  mAudioConsumerCount = 0;
 
   if (info->videoInfo.enabled) {
     state = CreatingVideo;
@@ -20,6 +33,7 @@ MediaProducer::~MediaProducer()
 {
   closeVideo();
   closeAudio();
+  mSocket = nullptr;
   info = nullptr;
   state = None;
 }
@@ -32,12 +46,33 @@ void MediaProducer::openVideo()
   }
 
   if (info->videoInfo.codec.mimeType.compare("video/h264") == 0) {
-    std::shared_ptr<RTPSender> sender = std::make_shared<H264RTPSender>();
+    std::shared_ptr<H264RTPSender> sender = std::make_shared<H264RTPSender>();
     sender->setDestIPAddress(video.ip);
     sender->setDestPort(video.port);
-    sender->setPortBase(0);
+    sender->setDestRtcpPort(video.rtcpPort);
+    sender->setSocket(mSocket);
+    sender->setMediaClock(mClock);
     sender->setFrequency(info->videoInfo.codec.clockRate);
+    sender->setBatchSize(info->rtpInfo.batchSize);
+    sender->setGsoEnabled(info->rtpInfo.gso);
+    // 音声はパケットが小さく一定間隔で送信されるので、映像だけペーシングを行います。
+    sender->setPacing(info->rtpInfo.pacing, info->rtpInfo.pacingMultiplier,
+        info->rtpInfo.pacingMinBitrate, info->rtpInfo.pacingMaxDelay);
+    sender->setNack(info->rtpInfo.nack, info->rtpInfo.nackMaxAge, info->rtpInfo.nackMaxBitrate);
+    if (info->rtpInfo.nack) {
+      sender->setRtxPayloadType(info->videoInfo.codec.rtxPayloadType);
+    }
+    sender->setGOPCache(info->rtpInfo.gopCache, info->rtpInfo.gopCacheMaxBytes, info->rtpInfo.gopCacheMinInterval);
+    if (info->rtpInfo.headerExtensions) {
+      sender->setHeaderExtensions(MEDIA_PRODUCER_VIDEO_MID);
+      sender->setFrameMarking(info->rtpInfo.frameMarking);
+      sender->setCongestionControl(info->rtpInfo.congestionControl,
+          info->rtpInfo.congestionControlMinBitrate, info->rtpInfo.congestionControlMaxBitrate);
+    }
     sender->open();
+
+    std::lock_guard<std::mutex> lock(mVideoConfigMutex);
+    sender->setParameterSets(mSequenceParameterSets, mPictureParameterSets);
     mVideoSender = sender;
   } else {
     LOG_WARN("VideoCodec not supported. codec=%s\n", info->videoInfo.codec.mimeType.c_str());
@@ -51,12 +86,22 @@ void MediaProducer::openAudio()
     return;
   }
 
-  if (info->audioInfo.codec.mimeType.compare("audio/opus") == 0) {
-    std::shared_ptr<RTPSender> sender = std::make_shared<OpusRTPSender>();
+  if (info->audioInfo.codec.mimeType.compare("audio/opus") == 0 ||
+      info->audioInfo.codec.mimeType.compare("audio/multiopus") == 0) {
+    std::shared_ptr<OpusRTPSender> sender = std::make_shared<OpusRTPSender>();
     sender->setDestIPAddress(audio.ip);
     sender->setDestPort(audio.port);
-    sender->setPortBase(0);
+    sender->setDestRtcpPort(audio.rtcpPort);
+    sender->setSocket(mSocket);
+    sender->setMediaClock(mClock);
     sender->setFrequency(info->audioInfo.codec.clockRate);
+    // RTP タイムスタンプはフレーム長に合わせて進めます。
+    sender->setTimestampIncrement(info->audioInfo.codec.clockRate * info->audioInfo.encoder.frameDuration / 1000);
+    sender->setBatchSize(info->rtpInfo.batchSize);
+    sender->setGsoEnabled(info->rtpInfo.gso);
+    if (info->rtpInfo.headerExtensions) {
+      sender->setHeaderExtensions(MEDIA_PRODUCER_AUDIO_MID);
+    }
     sender->open();
     mAudioSender = sender;
   } else {
@@ -72,6 +117,14 @@ int MediaProducer::getVideoSenderSSRC()
   return 0;
 }
 
+int MediaProducer::getVideoSenderRtxSSRC()
+{
+  if (mVideoSender) {
+    return mVideoSender->getRtxSSRC();
+  }
+  return 0;
+}
+
 int MediaProducer::getAudioSenderSSRC()
 {
   if (mAudioSender) {
@@ -82,24 +135,174 @@ int MediaProducer::getAudioSenderSSRC()
 
 void MediaProducer::closeVideo()
 {
-  mVideoSender = nullptr;
+  if (mVideoSender) {
+    mVideoSender->close();
+    mVideoSender = nullptr;
+  }
 }
 
 void MediaProducer::closeAudio()
 {
-  mAudioSender = nullptr;
+  if (mAudioSender) {
+    mAudioSender->close();
+    mAudioSender = nullptr;
+  }
 }
 
-void MediaProducer::sendVideo(const char *data, const uint32_t size)
+void MediaProducer::setVideoConfig(AVCDecoderConfigurationRecord *config)
 {
+  std::lock_guard<std::mutex> lock(mVideoConfigMutex);
+  mSequenceParameterSets = config->sequenceParameterSetNALUnits;
+  mPictureParameterSets = config->pictureParameterSetNALUnits;
   if (mVideoSender) {
-    mVideoSender->send(data, size);
+    mVideoSender->setParameterSets(mSequenceParameterSets, mPictureParameterSets);
   }
 }
 
-void MediaProducer::sendAudio(const char *data, const uint32_t size)
+void MediaProducer::setAudioConfig(AudioSpecificConfig *config)
 {
-  if (mAudioSender) {
-    mAudioSender->send(data, size);
+  const AudioEncoderInfo& encoder = info->audioInfo.encoder;
+  mAudioConv.setFrameDuration(encoder.frameDuration, encoder.framesPerPacket);
+  // AAC のチャンネル数に関わらず、producer に設定したチャンネル数に変換してエンコードします。
+  const AudioCodecInfo& codec = info->audioInfo.codec;
+  if (codec.mimeType.compare("audio/multiopus") == 0) {
+    std::vector<uint8_t> mapping(codec.channelMapping.begin(), codec.channelMapping.end());
+    mAudioConv.setMultistream(codec.numStreams, codec.coupledStreams, mapping);
+  } else {
+    mAudioConv.setChannels(codec.channels);
+  }
+  mAudioConv.setDriftCompensation(encoder.driftCompensation);
+  mAudioConv.setDtx(encoder.dtx, encoder.dtxThreshold, encoder.dtxHangover, encoder.dtxKeepAlive);
+  mAudioConv.init(config);
+  mAudioConfigured = true;
+  applyAudioEncoderSettings(true);
+}
+
+// 新しい Report Block を受信していたら、パケットロス率を更新してエンコーダの設定を見直します。
+void MediaProducer::updateAudioEncoder()
+{
+  if (!info->audioInfo.encoder.adaptive || !mAudioSender) {
+    return;
+  }
+
+  uint32_t reportCount = mAudioSender->getReceiverReportCount();
+  if (reportCount == mAudioReportCount) {
+    return;
+  }
+  mAudioReportCount = reportCount;
+
+  // パケットロスが増えた時にはすぐに追従し、減った時にはゆっくり戻します。
+  double lossRate = mAudioSender->getFractionLost() * 100.0 / 256.0;
+  if (lossRate > mAudioLossRate) {
+    mAudioLossRate = 0.5 * mAudioLossRate + 0.5 * lossRate;
+  } else {
+    mAudioLossRate = 0.9 * mAudioLossRate + 0.1 * lossRate;
+  }
+  applyAudioEncoderSettings(false);
+}
+
+// パケットロスがある場合には in-band FEC を有効にして、FEC の分だけビットレートを上げます。
+void MediaProducer::applyAudioEncoderSettings(bool force)
+{
+  const AudioEncoderInfo& encoder = info->audioInfo.encoder;
+
+  int packetLossPerc = encoder.packetLossPerc;
+  bool fec = encoder.fec;
+  int bitrate = encoder.bitrate;
+  if (encoder.adaptive) {
+    // 平滑化したパケットロス率は 0 に戻りきらないので、0.5 % 未満はロス無しとして扱います。
+    int measuredPerc = (mAudioLossRate < 0.5) ? 0 : (int)ceil(mAudioLossRate);
+    if (measuredPerc > packetLossPerc) {
+      packetLossPerc = measuredPerc;
+    }
+    fec = encoder.fec && packetLossPerc > 0;
+    if (fec) {
+      int perc = (packetLossPerc < OPUS_FEC_MAX_LOSS_PERC) ? packetLossPerc : OPUS_FEC_MAX_LOSS_PERC;
+      bitrate = encoder.bitrate * (100 + 2 * perc) / 100;
+      if (bitrate > encoder.maxBitrate) {
+        bitrate = (encoder.maxBitrate > encoder.bitrate) ? encoder.maxBitrate : encoder.bitrate;
+      }
+    }
+  }
+  if (packetLossPerc > 100) {
+    packetLossPerc = 100;
   }
+
+  if (!force && packetLossPerc == mAudioPacketLossPerc && fec == mAudioFec && bitrate == mAudioBitrate) {
+    return;
+  }
+
+  LOG_INFO("Update opus encoder. streamKey=%s loss=%.1f%% fec=%s packetLossPerc=%d bitrate=%d\n",
+      info->streamKey.c_str(), mAudioLossRate, fec ? "true" : "false", packetLossPerc, bitrate);
+  mAudioConv.setBitrate(bitrate);
+  mAudioConv.setInbandFec(fec);
+  mAudioConv.setPacketLossPerc(packetLossPerc);
+  mAudioBitrate = bitrate;
+  mAudioFec = fec;
+  mAudioPacketLossPerc = packetLossPerc;
+}
+
+void MediaProducer::restart()
+{
+  mClock->reset();
+  if (mVideoSender) {
+    mVideoSender->waitForKeyframe();
+  }
+}
+
+void MediaProducer::sendVideo(const H264AccessUnit *accessUnit)
+{
+  if (mVideoSender) {
+    mVideoSender->send(accessUnit);
+  }
+}
+
+void MediaProducer::sendAudio(const char *data, const uint32_t size, uint32_t timestamp)
+{
+  if (!mAudioConfigured) {
+    return;
+  }
+
+  // 視聴者がいない間は、AAC のデコードと Opus のエンコードを行いません。
+  bool active = !info->audioInfo.encoder.onDemand || mAudioConsumerCount > 0;
+  if (!active) {
+    if (!mAudioConv.isSuspended()) {
+      LOG_INFO("Suspend audio transcoding. streamKey=%s\n", info->streamKey.c_str());
+      mAudioConv.suspend();
+    }
+    return;
+  }
+  if (mAudioConv.isSuspended()) {
+    LOG_INFO("Resume audio transcoding. streamKey=%s\n", info->streamKey.c_str());
+    mAudioConv.resume();
+  }
+
+  updateAudioEncoder();
+
+  if (mAudioConv.decode((const uint8_t *)data, size, timestamp) < 0) {
+    LOG_ERROR("Failed to decode aac. streamKey=%s\n", info->streamKey.c_str());
+    return;
+  }
+
+  uint8_t encodeData[OPUS_ENCODE_BUFFER_SIZE];
+  int32_t encodeSize = 0;
+  OpusPacketInfo packet;
+  while ((encodeSize = mAudioConv.encode(encodeData, OPUS_ENCODE_BUFFER_SIZE, &packet)) >= 0) {
+    if (!mAudioSender) {
+      continue;
+    }
+    if (packet.anchorId != mAudioAnchorId) {
+      mAudioSender->setTimeline(packet.anchorTimestamp, packet.anchorPosition);
+      mAudioAnchorId = packet.anchorId;
+    }
+    // 無音で送信しなかったパケットは、次のパケットのタイムスタンプを進めるだけにします。
+    if (encodeSize > 0) {
+      mAudioSender->send((const char *)encodeData, encodeSize, packet.position, packet.frameCount);
+    }
+  }
+}
+
+void MediaProducer::setAudioConsumerCount(int count)
+{
+  mAudioConsumerCount = count;
 }
@@ -1,12 +1,22 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <vector>
 
-#include "../rtp/RTPSender.h"
+#include "../codec/h264/AVCDecoderConfigurationRecord.h"
+#include "../rtp/H264RTPSender.h"
+#include "../rtp/OpusRTPSender.h"
+#include "../utils/AAC2OpusConv.h"
 #include "../utils/Log.h"
 #include "../StreamInfo.h"
 #include "PlainTransport.h"
 
+// rtpParameters と拡張ヘッダーで使用する mid
+#define MEDIA_PRODUCER_VIDEO_MID "0"
+#define MEDIA_PRODUCER_AUDIO_MID "1"
+
 typedef enum {
   None,
   CreatingVideo,
@@ -16,8 +26,37 @@ typedef enum {
 
 class MediaProducer {
 private:
-  std::shared_ptr<RTPSender> mVideoSender;
-  std::shared_ptr<RTPSender> mAudioSender;
+  // コーデックごとの送信クラスを直接保持して、send を仮想関数経由で呼び出さないようにします。
+  std::shared_ptr<H264RTPSender> mVideoSender;
+  std::shared_ptr<OpusRTPSender> mAudioSender;
+  std::shared_ptr<RTPSocket> mSocket;
+  // 映像と音声で共有する時計
+  std::shared_ptr<MediaClock> mClock;
+
+  // RTMP のシーケンスヘッダーで受信した SPS/PPS
+  // 映像の送信クラスが作成される前に受信することもあるので、ここで保持しておきます。
+  std::mutex mVideoConfigMutex;
+  std::vector<std::vector<uint8_t>> mSequenceParameterSets;
+  std::vector<std::vector<uint8_t>> mPictureParameterSets;
+
+  // RTMP で受信した AAC を Opus に変換します。
+  // setAudioConfig と sendAudio は RTMP の受信スレッドから呼び出されます。
+  AAC2OpusConv mAudioConv;
+  bool mAudioConfigured;
+  // RTCP RR のパケットロス率に合わせたエンコーダの設定
+  uint32_t mAudioReportCount;
+  double mAudioLossRate;
+  int mAudioBitrate;
+  bool mAudioFec;
+  int mAudioPacketLossPerc;
+  // 送信側に設定したタイムスタンプの基準の番号
+  uint32_t mAudioAnchorId;
+  // mediasoup から通知された音声の consumer の数
+  // onDemand の場合には、consumer がいない間は変換と送信を止めます。
+  std::atomic<int> mAudioConsumerCount;
+
+  void updateAudioEncoder();
+  void applyAudioEncoderSettings(bool force);
 
 public:
   std::shared_ptr<StreamInfo> info;
@@ -26,18 +65,27 @@ public:
   PlainTransport audio;
 
 public:
-  MediaProducer(std::shared_ptr<StreamInfo> info);
+  MediaProducer(std::shared_ptr<StreamInfo> info, std::shared_ptr<RTPSocket> socket);
   virtual ~MediaProducer();
 
   void openVideo();
   void openAudio();
 
   int getVideoSenderSSRC();
+  int getVideoSenderRtxSSRC();
   int getAudioSenderSSRC();
 
   void closeVideo();
   void closeAudio();
 
-  void sendVideo(const char *data, const uint32_t size);
-  void sendAudio(const char *data, const uint32_t size);
+  void setVideoConfig(AVCDecoderConfigurationRecord *config);
+  void setAudioConfig(AudioSpecificConfig *config);
+  // 配信が再開された時に呼び出します。
+  // 時計を合わせ直して、次のキーフレームから映像の送信を再開します。
+  void restart();
+  void sendVideo(const H264AccessUnit *accessUnit);
+  // data には AAC の raw データを指定します。Opus に変換して送信します。
+  void sendAudio(const char *data, const uint32_t size, uint32_t timestamp);
+  // 音声の producer の consumer の数を設定します。mediasoup との通信スレッドから呼び出されます。
+  void setAudioConsumerCount(int count);
 };
@@ -6,6 +6,7 @@
 #define UUID_DESTROY_SESSION "destroySession"
 #define UUID_PAUSE_PRODUCER "pauseProducer"
 #define UUID_RESUME_PRODUCER "resumeProducer"
+#define UUID_CONSUMER_COUNT "consumerCount"
 
 MediasoupClient::MediasoupClient(std::string name) : mName(name)
 {
@@ -14,6 +15,17 @@ MediasoupClient::MediasoupClient(std::string name) : mName(name)
 MediasoupClient::~MediasoupClient()
 {
   disconnect();
+  closeRtpSockets();
+}
+
+bool MediasoupClient::openRtpSockets(int count, int port)
+{
+  return mSocketPool.open(count, port);
+}
+
+void MediasoupClient::closeRtpSockets()
+{
+  mSocketPool.close();
 }
 
 void MediasoupClient::connect(std::string uri, std::string origin)
@@ -42,11 +54,14 @@ void MediasoupClient::createNextProducer()
 
 void MediasoupClient::requestPlainRtpTransport()
 {
+  // rtcp-mux を使用する場合には、RTP と RTCP を同じポートで送受信します。
+  bool rtcpMux = mCreatingProducers.front()->info->rtpInfo.rtcpMux;
+
   json j = json{
     {"uuid", UUID_CREATE_PLAIN_TRANSPORT},
     {"type", "createPlainTransport"},
     {"payload", json{
-      {"rtcpMux", false},
+      {"rtcpMux", rtcpMux},
       {"comedia", true}
     }}
   };
@@ -55,6 +70,16 @@ void MediasoupClient::requestPlainRtpTransport()
   mWebsocketClient.sendMessage(msg);
 }
 
+// RTPSender が付加する拡張ヘッダーを rtpParameters の headerExtensions の形式で返します。
+json MediasoupClient::makeHeaderExtensions()
+{
+  return json{
+    json{{"uri", RTP_EXTENSION_URI_MID}, {"id", RTP_EXTENSION_ID_MID}},
+    json{{"uri", RTP_EXTENSION_URI_ABS_SEND_TIME}, {"id", RTP_EXTENSION_ID_ABS_SEND_TIME}},
+    json{{"uri", RTP_EXTENSION_URI_TRANSPORT_WIDE_CC}, {"id", RTP_EXTENSION_ID_TRANSPORT_WIDE_CC}}
+  };
+}
+
 void MediasoupClient::requestCreateProducer(std::string id, std::string kind, json rtpParameters)
 {
   json j = json{
@@ -110,25 +135,41 @@ void MediasoupClient::createMediaProducer(std::shared_ptr<StreamInfo> info)
     return;
   }
 
-  std::shared_ptr<MediaProducer> producer = std::make_shared<MediaProducer>(info);
+  std::shared_ptr<MediaProducer> producer = std::make_shared<MediaProducer>(info, mSocketPool.get());
   mProducerMap.add(info->streamKey, producer);
   mCreatingProducers.push(producer);
   createNextProducer();
 }
 
-void MediasoupClient::sendVideoData(std::string streamKey, const char *data, const uint32_t size)
+void MediasoupClient::setVideoConfig(std::string streamKey, AVCDecoderConfigurationRecord *config)
+{
+  std::shared_ptr<MediaProducer> producer = mProducerMap.get(streamKey);
+  if (producer) {
+    producer->setVideoConfig(config);
+  }
+}
+
+void MediasoupClient::setAudioConfig(std::string streamKey, AudioSpecificConfig *config)
 {
   std::shared_ptr<MediaProducer> producer = mProducerMap.get(streamKey);
   if (producer) {
-    producer->sendVideo(data, size);
+    producer->setAudioConfig(config);
   }
 }
 
-void MediasoupClient::sendAudioData(std::string streamKey, const char *data, const uint32_t size)
+void MediasoupClient::sendVideoData(std::string streamKey, const H264AccessUnit *accessUnit)
 {
   std::shared_ptr<MediaProducer> producer = mProducerMap.get(streamKey);
   if (producer) {
-    producer->sendAudio(data, size);
+    producer->sendVideo(accessUnit);
+  }
+}
+
+void MediasoupClient::sendAudioData(std::string streamKey, const char *data, const uint32_t size, uint32_t timestamp)
+{
+  std::shared_ptr<MediaProducer> producer = mProducerMap.get(streamKey);
+  if (producer) {
+    producer->sendAudio(data, size, timestamp);
   }
 }
 
@@ -165,6 +206,7 @@ void MediasoupClient::resume(std::string streamKey)
 {
   std::shared_ptr<MediaProducer> producer = mProducerMap.get(streamKey);
   if (producer) {
+    producer->restart();
     {
       json j = json{
         {"uuid", UUID_RESUME_PRODUCER},
@@ -200,7 +242,11 @@ void MediasoupClient::onMediasoupSendPlainTransport(json& payload)
   std::string id = payload["id"].get<std::string>();
   std::string ip = payload["ip"].get<std::string>();
   int port = payload["port"].get<int>();
-  int rtcpPort = payload["rtcpPort"].get<int>();
+  // rtcp-mux の場合には rtcpPort は含まれていないので、RTP と同じポートを使用します。
+  int rtcpPort = 0;
+  if (payload.find("rtcpPort") != payload.end() && payload["rtcpPort"].is_number()) {
+    rtcpPort = payload["rtcpPort"].get<int>();
+  }
 
   std::shared_ptr<MediaProducer> producer = mCreatingProducers.front();
   switch (producer->state) {
@@ -212,25 +258,71 @@ void MediasoupClient::onMediasoupSendPlainTransport(json& payload)
       producer->video.rtcpPort = rtcpPort;
       producer->openVideo();
 
+      // mediasoup は rtcpFeedback に nack が指定されていない場合には、NACK を送信してこないので指定しておきます。
+      json rtcpFeedback = json::array();
+      if (producer->info->rtpInfo.nack) {
+        rtcpFeedback.push_back(json{{"type", "nack"}});
+      }
+      // PLI/FIR を受信した時には GOP キャッシュを送信し直します。
+      if (producer->info->rtpInfo.gopCache) {
+        rtcpFeedback.push_back(json{{"type", "nack"}, {"parameter", "pli"}});
+        rtcpFeedback.push_back(json{{"type", "ccm"}, {"parameter", "fir"}});
+      }
+      // transport-wide-cc の拡張ヘッダーを付けている場合には、mediasoup から transport-cc のフィードバックを受け取ります。
+      if (producer->info->rtpInfo.headerExtensions) {
+        rtcpFeedback.push_back(json{{"type", "transport-cc"}});
+      }
+
+      json codecs = json{
+        json{
+          {"mimeType", producer->info->videoInfo.codec.mimeType},
+          {"payloadType", producer->info->videoInfo.codec.payloadType},
+          {"clockRate", producer->info->videoInfo.codec.clockRate},
+          {"parameters", json{
+            {"packetization-mode", 1},
+            {"profile-level-id", "42e01f"},
+            {"level-asymmetry-allowed", 1}
+          }},
+          {"rtcpFeedback", rtcpFeedback}
+        }
+      };
+
+      // SSRC は 32 bit の符号なし整数なので、負の値にならないようにします。
+      json encoding = json{
+        {"ssrc", (uint32_t)producer->getVideoSenderSSRC()}
+      };
+
+      // 再送を RTX で行う場合には、RTX のコーデックと SSRC を通知します。
+      uint32_t rtxSSRC = (uint32_t)producer->getVideoSenderRtxSSRC();
+      if (rtxSSRC != 0) {
+        codecs.push_back(json{
+          {"mimeType", "video/rtx"},
+          {"payloadType", producer->info->videoInfo.codec.rtxPayloadType},
+          {"clockRate", producer->info->videoInfo.codec.clockRate},
+          {"parameters", json{
+            {"apt", producer->info->videoInfo.codec.payloadType}
+          }}
+        });
+        encoding["rtx"] = json{
+          {"ssrc", rtxSSRC}
+        };
+      }
+
       json rtpParameters = json{
-        {"codecs", json{
-          json{
-            {"mimeType", producer->info->videoInfo.codec.mimeType},
-            {"payloadType", producer->info->videoInfo.codec.payloadType},
-            {"clockRate", producer->info->videoInfo.codec.clockRate},
-            {"parameters", json{
-              {"packetization-mode", 1},
-              {"profile-level-id", "42e01f"},
-              {"level-asymmetry-allowed", 1}
-            }}
-          }
-        }},
-        {"encodings", json{
-          json{
-            {"ssrc", producer->getVideoSenderSSRC()}
-          }
-        }}
+        {"codecs", codecs},
+        {"encodings", json{encoding}}
       };
+      if (producer->info->rtpInfo.headerExtensions) {
+        rtpParameters["mid"] = MEDIA_PRODUCER_VIDEO_MID;
+        rtpParameters["headerExtensions"] = makeHeaderExtensions();
+        // 参照されないフレームを上位のレイヤー (TID=1) として通知するので、mediasoup は
+        // コンシューマーごとに上位のレイヤーを落としてフレームレートを下げられます。
+        if (producer->info->rtpInfo.frameMarking) {
+          rtpParameters["headerExtensions"].push_back(
+              json{{"uri", RTP_EXTENSION_URI_FRAME_MARKING}, {"id", RTP_EXTENSION_ID_FRAME_MARKING}});
+          rtpParameters["encodings"][0]["scalabilityMode"] = "L1T2";
+        }
+      }
 
       requestCreateProducer(id, "video", rtpParameters);
     } break;
@@ -256,10 +348,29 @@ void MediasoupClient::onMediasoupSendPlainTransport(json& payload)
         }},
         {"encodings", json{
           json{
-            {"ssrc", producer->getAudioSenderSSRC()}
+            {"ssrc", (uint32_t)producer->getAudioSenderSSRC()}
           }
         }}
       };
+      if (producer->info->audioInfo.codec.mimeType.compare("audio/multiopus") == 0) {
+        const AudioCodecInfo& codec = producer->info->audioInfo.codec;
+        std::string mapping;
+        for (size_t i = 0; i < codec.channelMapping.size(); i++) {
+          mapping += (i == 0 ? "" : ",") + std::to_string(codec.channelMapping[i]);
+        }
+        rtpParameters["codecs"][0]["parameters"] = json{
+          {"num_streams", codec.numStreams},
+          {"coupled_streams", codec.coupledStreams},
+          {"channel_mapping", mapping}
+        };
+      }
+      if (producer->info->rtpInfo.headerExtensions) {
+        rtpParameters["codecs"][0]["rtcpFeedback"] = json{
+          json{{"type", "transport-cc"}}
+        };
+        rtpParameters["mid"] = MEDIA_PRODUCER_AUDIO_MID;
+        rtpParameters["headerExtensions"] = makeHeaderExtensions();
+      }
 
       requestCreateProducer(id, "audio", rtpParameters);
     } break;
@@ -275,6 +386,7 @@ void MediasoupClient::onMediasoupProducer(json& payload)
   switch (producer->state) {
     case CreatingVideo:
     {
+      producer->video.producerId = payload["id"].get<std::string>();
       if (producer->info->audioInfo.enabled) {
         producer->state = CreatingAudio;
         requestPlainRtpTransport();
@@ -286,6 +398,8 @@ void MediasoupClient::onMediasoupProducer(json& payload)
     } break;
     case CreatingAudio:
     {
+      producer->audio.producerId = payload["id"].get<std::string>();
+      mAudioProducerMap.add(producer->audio.producerId, producer);
       producer->state = Created;
       mCreatingProducers.pop();
       createNextProducer();
@@ -296,6 +410,18 @@ void MediasoupClient::onMediasoupProducer(json& payload)
   }
 }
 
+// mediasoup から consumer が作成、削除されるたびに通知されます。
+void MediasoupClient::onMediasoupConsumerCount(json& payload)
+{
+  auto producerId = payload["producerId"].get<std::string>();
+  int count = payload["count"].get<int>();
+  std::shared_ptr<MediaProducer> producer = mAudioProducerMap.get(producerId);
+  if (producer) {
+    LOG_DEBUG("Audio consumer count. streamKey=%s count=%d\n", producer->info->streamKey.c_str(), count);
+    producer->setAudioConsumerCount(count);
+  }
+}
+
 // WebsocketClientListener implements.
 
 void MediasoupClient::onConnected(WebsocketClient *client)
@@ -308,6 +434,7 @@ void MediasoupClient::onDisconnected(WebsocketClient *client)
 {
   LOG_INFO("Disconnected to mediasoup.\n");
   mProducerMap.clear();
+  mAudioProducerMap.clear();
 }
 
 void MediasoupClient::onFailedToConnect(WebsocketClient *client)
@@ -331,6 +458,8 @@ void MediasoupClient::onMessage(WebsocketClient *client, std::string& message)
         onMediasoupProducer(payload);
       } else if (uuid.compare(UUID_PAUSE_PRODUCER) == 0) {
       } else if (uuid.compare(UUID_RESUME_PRODUCER) == 0) {
+      } else if (uuid.compare(UUID_CONSUMER_COUNT) == 0) {
+        onMediasoupConsumerCount(payload);
       } else {
         LOG_WARN("Unknown uuid. uuid=%s\n", uuid.c_str());
       }
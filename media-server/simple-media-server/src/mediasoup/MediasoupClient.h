@@ -25,6 +25,9 @@ private:
   WebsocketClient mWebsocketClient;
   SafeQueue<std::shared_ptr<MediaProducer>> mCreatingProducers;
   SafeMap<std::string, std::shared_ptr<MediaProducer>> mProducerMap;
+  // consumer の数の通知を受け取るための、音声の producer の ID から MediaProducer へのマップ
+  SafeMap<std::string, std::shared_ptr<MediaProducer>> mAudioProducerMap;
+  RTPSocketPool mSocketPool;
   std::string mName;
   std::string mId;
 
@@ -32,15 +35,21 @@ private:
   void createNextProducer();
   void requestPlainRtpTransport();
   void requestCreateProducer(std::string id, std::string kind, json rtpParameters);
+  json makeHeaderExtensions();
 
   void onMediasoupCreateSession(json& payload);
   void onMediasoupSendPlainTransport(json& payload);
   void onMediasoupProducer(json& payload);
+  void onMediasoupConsumerCount(json& payload);
 
 public:
   MediasoupClient(std::string name);
   virtual ~MediasoupClient();
 
+  // 全ての MediaProducer で共有する RTP 送信用のソケットを作成します。
+  bool openRtpSockets(int count, int port);
+  void closeRtpSockets();
+
   void connect(std::string uri, std::string origin);
   void disconnect();
 
@@ -48,8 +57,10 @@ public:
   void destroyMediaSession();
   void createMediaProducer(std::shared_ptr<StreamInfo> info);
 
-  void sendVideoData(std::string streamKey, const char *data, const uint32_t size);
-  void sendAudioData(std::string streamKey, const char *data, const uint32_t size);
+  void setVideoConfig(std::string streamKey, AVCDecoderConfigurationRecord *config);
+  void setAudioConfig(std::string streamKey, AudioSpecificConfig *config);
+  void sendVideoData(std::string streamKey, const H264AccessUnit *accessUnit);
+  void sendAudioData(std::string streamKey, const char *data, const uint32_t size, uint32_t timestamp);
 
   void pause(std::string streamKey);
   void resume(std::string streamKey);
@@ -8,4 +8,6 @@ public:
   std::string ip;
   int port;
   int rtcpPort;
+  // mediasoup で作成された producer の ID
+  std::string producerId;
 };
\ No newline at end of file
@@ -455,26 +455,15 @@ void RTMPClient::HandleAudio(RTMP *r, const RTMPPacket *packet)
       if (mListener) {
         mListener->onReceivedAudioConfig(this, &mAacConfig);
       }
-      conv.init(&mAacConfig);
     } else if (AACPacketType == RTMP_AUDIO_AAC_PACKET_TYPE_AAC_RAW) {
       // AAC raw
-      // if (mListener) {
-      //   mListener->OnReceivedAudioData(this, (const uint8_t *)&body[2], nBodySize - 2, timestamp);
-      // }
-
       // タイムスタンプ: frameSize/sampleRate = 1024/48000 = 0.021秒 = 21ms
       // OBS からは、21ms ごとに送られてきているっぽい。
 
-      // AAC を Opus に変換をかけて配信します。
+      // Opus への変換は、受信側のパケットロスに合わせてエンコーダを調整できるように
+      // ストリームごとの MediaProducer で行います。
       if (mListener) {
-        if (conv.decode((const uint8_t *)&body[2], nBodySize - 2) < 0) {
-          LOG_ERROR("error\n");
-        }
-        uint8_t encodeData[20 * 1024];
-        int32_t encodeSize = 0;
-        while ((encodeSize = conv.encode(encodeData, 20 * 1024)) > 0) {
-          mListener->onReceivedAudioData(this, (const char *)encodeData, encodeSize, timestamp);
-        }
+        mListener->onReceivedAudioData(this, &body[2], nBodySize - 2, timestamp);
       }
     }
   } else {
@@ -502,7 +491,11 @@ void RTMPClient::HandleVideo(RTMP *r, const RTMPPacket *packet)
 
   if (CodecId == RTMP_VIDEO_CODEC_ID_AVC) {
     uint8_t AVCPacketType = body[1];
-    uint32_t CompositionTime = ((body[2] & 0xFF) << 16) | ((body[3] & 0xFF) << 8) | (body[4] & 0xFF);
+    int32_t CompositionTime = ((body[2] & 0xFF) << 16) | ((body[3] & 0xFF) << 8) | (body[4] & 0xFF);
+    // SI24 なので符号拡張します。
+    if (CompositionTime & 0x800000) {
+      CompositionTime |= 0xFF000000;
+    }
 
     // VideoTagBody
     if (AVCPacketType == RTMP_VIDEO_AVC_PACKET_TYPE_AVC_HEADER) {
@@ -518,20 +511,36 @@ void RTMPClient::HandleVideo(RTMP *r, const RTMPPacket *packet)
       uint32_t index = 0;
       int NALUnitLen = mAvcConfig.lengthSizeMinusOne + 1;
 
-      // NAL Unit ごとに分解して、リスナーに通知します。
-      while (index < nalByteSize) {
+      mAccessUnit.clear();
+      mAccessUnit.dts = timestamp;
+      mAccessUnit.compositionTime = CompositionTime;
+      mAccessUnit.frameType = FrameType;
+      mAccessUnit.keyframe = (FrameType == RTMP_VIDEO_FRAME_TYPE_KEYFRAME);
+
+      // NAL Unit ごとに分解して、アクセスユニットとしてまとめてリスナーに通知します。
+      while (index + NALUnitLen <= nalByteSize) {
         uint32_t NALUnitSize = 0;
         for (int i = 0; i < NALUnitLen; i++) {
           NALUnitSize <<= 8;
           NALUnitSize |= (nalBytes[index++] & 0xFF);
         }
 
-        if (mListener) {
-          mListener->onReceivedVideoData(this, &nalBytes[index], NALUnitSize, timestamp);
+        if (NALUnitSize == 0 || NALUnitSize > nalByteSize - index) {
+          LOG_WARN("Invalid NAL unit size. size=%u\n", NALUnitSize);
+          break;
         }
 
+        H264NalUnit nalUnit;
+        nalUnit.data = &nalBytes[index];
+        nalUnit.size = NALUnitSize;
+        mAccessUnit.nalUnits.push_back(nalUnit);
+
         index += NALUnitSize;
       }
+
+      if (mListener && !mAccessUnit.nalUnits.empty()) {
+        mListener->onReceivedVideoData(this, &mAccessUnit);
+      }
     } else if (AVCPacketType == RTMP_VIDEO_AVC_PACKET_TYPE_AVC_EOS) {
       // AVC end sequence
       // TODO: 未実装
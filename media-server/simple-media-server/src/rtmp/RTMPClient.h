@@ -8,11 +8,11 @@
 
 #include "../codec/aac/AudioSpecificConfig.h"
 #include "../codec/h264/AVCDecoderConfigurationRecord.h"
+#include "../codec/h264/H264AccessUnit.h"
 
 #include "../utils/BaseThread.h"
 #include "../utils/Log.h"
 #include "../utils/NetworkUtils.h"
-#include "../utils/AAC2OpusConv.h"
 
 class RTMPClient;
 
@@ -22,7 +22,8 @@ public:
   virtual void onClosed(RTMPClient *client) {}
   virtual void onReceivedVideoConfig(RTMPClient *client, AVCDecoderConfigurationRecord *config) {}
   virtual void onReceivedAudioConfig(RTMPClient *client, AudioSpecificConfig *config) {}
-  virtual void onReceivedVideoData(RTMPClient *client, const char *data, uint32_t size, uint32_t timestamp) {}
+  virtual void onReceivedVideoData(RTMPClient *client, const H264AccessUnit *accessUnit) {}
+  // data には AAC の raw データが格納されています。
   virtual void onReceivedAudioData(RTMPClient *client, const char *data, uint32_t size, uint32_t timestamp) {}
 };
 
@@ -34,6 +35,8 @@ private:
   int mStreamID;
   AVCDecoderConfigurationRecord mAvcConfig;
   AudioSpecificConfig mAacConfig;
+  // 毎回確保し直さないように使い回します。
+  H264AccessUnit mAccessUnit;
 
   typedef void (RTMPClient::*ParsePacketFunc)(RTMP *rtmp, const RTMPPacket *packet);
   std::map<int, ParsePacketFunc> Functions;
@@ -77,6 +80,4 @@ public:
   void setListener(RTMPClientListener *listener) {
     mListener = listener;
   }
-
-  AAC2OpusConv conv;
 };
@@ -172,16 +172,16 @@ void RTMPServer::onReceivedAudioConfig(RTMPClient *client, AudioSpecificConfig *
   }
 }
 
-void RTMPServer::onReceivedVideoData(RTMPClient *client, const char *data, uint32_t size, uint32_t timestamp)
+void RTMPServer::onReceivedVideoData(RTMPClient *client, const H264AccessUnit *accessUnit)
 {
   if (mListener) {
-    mListener->onReceivedVideoData(this, client->streamKey, data, size);
+    mListener->onReceivedVideoData(this, client->streamKey, accessUnit);
   }
 }
 
 void RTMPServer::onReceivedAudioData(RTMPClient *client, const char *data, uint32_t size, uint32_t timestamp)
 {
   if (mListener) {
-    mListener->onReceivedAudioData(this, client->streamKey, data, size);
+    mListener->onReceivedAudioData(this, client->streamKey, data, size, timestamp);
   }
 }
@@ -0,0 +1,96 @@
+#include "H264GOPCache.h"
+#include "../utils/Log.h"
+#include <string.h>
+
+// 再利用のために保持しておくアクセスユニット数の上限
+#define H264_GOP_CACHE_MAX_FREE_ACCESS_UNITS 64
+
+H264GOPCache::H264GOPCache()
+{
+  mBytes = 0;
+  mMaxBytes = 8 * 1024 * 1024;
+  mValid = false;
+}
+
+H264GOPCache::~H264GOPCache()
+{
+  release();
+  for (auto accessUnit : mFreeAccessUnits) {
+    delete accessUnit;
+  }
+  mFreeAccessUnits.clear();
+}
+
+void H264GOPCache::setMaxBytes(size_t maxBytes)
+{
+  mMaxBytes = maxBytes;
+}
+
+void H264GOPCache::release()
+{
+  for (auto accessUnit : mAccessUnits) {
+    if (mFreeAccessUnits.size() < H264_GOP_CACHE_MAX_FREE_ACCESS_UNITS) {
+      mFreeAccessUnits.push_back(accessUnit);
+    } else {
+      delete accessUnit;
+    }
+  }
+  mAccessUnits.clear();
+  mBytes = 0;
+}
+
+void H264GOPCache::clear()
+{
+  release();
+  mValid = false;
+}
+
+void H264GOPCache::add(const H264AccessUnit *accessUnit)
+{
+  if (accessUnit->hasIdr()) {
+    // 新しい GOP が始まったので、古い GOP は破棄します。
+    release();
+    mValid = true;
+  } else if (!mValid) {
+    return;
+  }
+
+  size_t size = 0;
+  for (auto& nalUnit : accessUnit->nalUnits) {
+    size += nalUnit.size;
+  }
+
+  if (mBytes + size > mMaxBytes) {
+    LOG_WARN("GOP cache is full. Disable cache until next keyframe. bytes=%zu\n", mBytes + size);
+    clear();
+    return;
+  }
+
+  H264CachedAccessUnit *cached = nullptr;
+  if (mFreeAccessUnits.empty()) {
+    cached = new H264CachedAccessUnit();
+  } else {
+    cached = mFreeAccessUnits.back();
+    mFreeAccessUnits.pop_back();
+  }
+
+  cached->buffer.resize(size);
+  cached->accessUnit.clear();
+  cached->accessUnit.dts = accessUnit->dts;
+  cached->accessUnit.compositionTime = accessUnit->compositionTime;
+  cached->accessUnit.frameType = accessUnit->frameType;
+  cached->accessUnit.keyframe = accessUnit->keyframe;
+
+  size_t offset = 0;
+  for (auto& nalUnit : accessUnit->nalUnits) {
+    memcpy(&cached->buffer[offset], nalUnit.data, nalUnit.size);
+    H264NalUnit cachedNalUnit;
+    cachedNalUnit.data = (const char *)&cached->buffer[offset];
+    cachedNalUnit.size = nalUnit.size;
+    cached->accessUnit.nalUnits.push_back(cachedNalUnit);
+    offset += nalUnit.size;
+  }
+
+  mAccessUnits.push_back(cached);
+  mBytes += size;
+}
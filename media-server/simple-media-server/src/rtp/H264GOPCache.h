@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "../codec/h264/H264AccessUnit.h"
+
+// GOP キャッシュに保持しているアクセスユニット
+// NAL ユニットは buffer にコピーして、accessUnit の nalUnits から参照します。
+class H264CachedAccessUnit {
+public:
+  std::vector<uint8_t> buffer;
+  H264AccessUnit accessUnit;
+};
+
+// 最後に受信したキーフレームと、それ以降のフレームを保持します。
+//
+// RTMP ではエンコーダにキーフレームを要求できないので、PLI/FIR を受信した時には
+// キャッシュしている GOP を送信し直して、途中から受信を開始したコンシューマーがすぐに
+// デコードを開始できるようにします。
+// 保持できる上限を超えた場合には、次のキーフレームまでキャッシュを無効にします。
+class H264GOPCache {
+private:
+  std::vector<H264CachedAccessUnit *> mAccessUnits;
+  std::vector<H264CachedAccessUnit *> mFreeAccessUnits;
+  size_t mBytes;
+  size_t mMaxBytes;
+  bool mValid;
+
+  void release();
+
+public:
+  H264GOPCache();
+  virtual ~H264GOPCache();
+
+  // 保持する最大バイト数を設定します。
+  void setMaxBytes(size_t maxBytes);
+
+  void add(const H264AccessUnit *accessUnit);
+  void clear();
+
+  // キーフレームから始まる GOP を保持している場合には true を返します。
+  bool isValid() {
+    return mValid && !mAccessUnits.empty();
+  }
+
+  size_t size() {
+    return mAccessUnits.size();
+  }
+
+  const H264AccessUnit *get(size_t index) {
+    return &mAccessUnits[index]->accessUnit;
+  }
+};
@@ -1,28 +1,478 @@
 #include "H264RTPSender.h"
+#include "../utils/TimeUtils.h"
 
 // see https://tex2e.github.io/rfc-translater/html/rfc3984.html
 
+// 間引きを強くするまでの最小間隔
+#define H264_DROP_LEVEL_INCREASE_INTERVAL_US 500000
+// 間引きを弱くできる状態がこの時間続いたら、1 段階ずつ弱くします。
+#define H264_DROP_LEVEL_DECREASE_HOLD_US 2000000
+// 間引きを弱くする時に、推定ビットレートに持たせる余裕
+#define H264_DROP_LEVEL_DECREASE_MARGIN 1.1
+// フレームの種類ごとのビットレートを計測する間隔
+#define H264_FRAME_STATS_WINDOW_US 1000000
+// GOP キャッシュを送信し直す時に、1 つのアクセスユニットを受信するごとに送信する最大のアクセスユニット数
+// 受信するアクセスユニットよりも多く送信して、送信し直している間に溜まったフレームに追いつきます。
+#define H264_GOP_REPLAY_FRAMES_PER_SEND 3
+
 H264RTPSender::H264RTPSender()
 {
-  mFps = 30;
   mPayloadType = 96;
   mFrequency = 90000.0;
-  mTimestampIncrement = (uint32_t)mFrequency / mFps;
+  mTimestampIncrement = 0;
+  mGOPCacheEnabled = false;
+  mKeyframeMinIntervalMs = 1000;
+  mLastReplayTimeUs = 0;
+  mReplaying = false;
+  mReplayIndex = 0;
+  mLastSentTimestamp = 0;
+  mHasSentTimestamp = false;
+  mKeyframeRequested = false;
+  mRestartRequested = false;
+  // 途中から送信を開始した場合に、デコードできないフレームを送らないようにします。
+  mWaitingKeyframe = true;
+  mDroppedCount = 0;
+  mBaseLayerIndex = 0;
+  mDropLevel = H264DropNone;
+  mLastDropLevelChangeTimeUs = 0;
+  mDropLevelDecreaseTimeUs = 0;
+  mThinningWaitingKeyframe = false;
+  mCongestionDroppedCount = 0;
+  mGopStarted = false;
+  mGopStartDts = 0;
+  mLastGopDurationMs = 0;
+  mGopSentBytes = 0;
+  mFrameStatsStartTimeUs = 0;
+  mKeyframeBytes = 0;
+  mReferenceBytes = 0;
+  mNonReferenceBytes = 0;
+  mKeyframeBitrate = 0;
+  mReferenceBitrate = 0;
+  mNonReferenceBitrate = 0;
 }
 
 H264RTPSender::~H264RTPSender()
 {
+  // RTCP の受信スレッドから派生クラスの仮想関数が呼び出されないように、
+  // 派生クラスのメンバーが破棄される前にソケットから登録を解除します。
+  close();
+}
+
+void H264RTPSender::setParameterSets(const std::vector<std::vector<uint8_t>>& sps, const std::vector<std::vector<uint8_t>>& pps)
+{
+  mSequenceParameterSets = sps;
+  mPictureParameterSets = pps;
+}
+
+void H264RTPSender::setGOPCache(bool enabled, size_t maxBytes, uint32_t minInterval)
+{
+  mGOPCacheEnabled = enabled;
+  mGOPCache.setMaxBytes(maxBytes);
+  mKeyframeMinIntervalMs = minInterval;
+}
+
+void H264RTPSender::waitForKeyframe()
+{
+  mRestartRequested = true;
+}
+
+void H264RTPSender::onKeyframeRequested()
+{
+  mKeyframeRequested = true;
+}
+
+// OBS などはシーケンスヘッダーでしか SPS/PPS を送信してこないので、途中から受信を開始した
+// コンシューマーがデコードを開始できるように、IDR の前に SPS/PPS を挿入します。
+const H264AccessUnit *H264RTPSender::injectParameterSets(const H264AccessUnit *accessUnit)
+{
+  if (mSequenceParameterSets.empty() || mPictureParameterSets.empty()) {
+    return accessUnit;
+  }
+
+  bool hasSps = false;
+  bool hasPps = false;
+  int idrIndex = -1;
+  for (size_t i = 0; i < accessUnit->nalUnits.size(); i++) {
+    unsigned char naluType = accessUnit->nalUnits[i].data[0] & 0x1F;
+    if (naluType == 7) {
+      hasSps = true;
+    } else if (naluType == 8) {
+      hasPps = true;
+    } else if (naluType == 5 && idrIndex < 0) {
+      idrIndex = i;
+    }
+  }
+
+  if (idrIndex < 0 || (hasSps && hasPps)) {
+    return accessUnit;
+  }
+
+  // AUD や SEI の後ろ、最初の IDR スライスの前に SPS/PPS を挿入します。
+  mInjectedAccessUnit.clear();
+  mInjectedAccessUnit.dts = accessUnit->dts;
+  mInjectedAccessUnit.compositionTime = accessUnit->compositionTime;
+  mInjectedAccessUnit.frameType = accessUnit->frameType;
+  mInjectedAccessUnit.keyframe = accessUnit->keyframe;
+  mInjectedAccessUnit.nalUnits.insert(mInjectedAccessUnit.nalUnits.end(),
+      accessUnit->nalUnits.begin(), accessUnit->nalUnits.begin() + idrIndex);
+  for (auto& sps : mSequenceParameterSets) {
+    H264NalUnit nalUnit;
+    nalUnit.data = (const char *)sps.data();
+    nalUnit.size = sps.size();
+    mInjectedAccessUnit.nalUnits.push_back(nalUnit);
+  }
+  for (auto& pps : mPictureParameterSets) {
+    H264NalUnit nalUnit;
+    nalUnit.data = (const char *)pps.data();
+    nalUnit.size = pps.size();
+    mInjectedAccessUnit.nalUnits.push_back(nalUnit);
+  }
+  mInjectedAccessUnit.nalUnits.insert(mInjectedAccessUnit.nalUnits.end(),
+      accessUnit->nalUnits.begin() + idrIndex, accessUnit->nalUnits.end());
+  return &mInjectedAccessUnit;
+}
+
+void H264RTPSender::send(const H264AccessUnit *accessUnit)
+{
+  if (mRestartRequested.exchange(false)) {
+    mGOPCache.clear();
+    mReplaying = false;
+    mHasSentTimestamp = false;
+    mWaitingKeyframe = true;
+    mThinningWaitingKeyframe = false;
+    mGopStarted = false;
+  }
+
+  if (accessUnit->hasIdr()) {
+    // キーフレームが来たので、キーフレームの要求は満たされます。
+    if (mWaitingKeyframe && mDroppedCount > 0) {
+      LOG_INFO("Start sending video from keyframe. ssrc=%u dropped=%u\n", mSSRC, mDroppedCount);
+    }
+    mWaitingKeyframe = false;
+    mKeyframeRequested = false;
+    mReplaying = false;
+    mDroppedCount = 0;
+  } else if (!mReplaying && (mWaitingKeyframe || mKeyframeRequested)) {
+    // 送信し直している間に受けた要求は、送信し直しが終わってから処理します。
+    if (replayGOPCache()) {
+      mWaitingKeyframe = false;
+      mKeyframeRequested = false;
+    } else if (mWaitingKeyframe) {
+      // デコードできないフレームは送信せずに、次のキーフレームを待ちます。
+      mDroppedCount++;
+      return;
+    }
+  }
+
+  if (mGOPCacheEnabled) {
+    mGOPCache.add(accessUnit);
+  }
+
+  // GOP キャッシュを送信し直している間は、受信したアクセスユニットもキャッシュから順番に送信します。
+  if (mReplaying) {
+    continueGOPReplay();
+    return;
+  }
+
+  // 送信先までの帯域が足りない場合には、デコードできる状態を保ったままフレームを間引きます。
+  // GOP キャッシュには間引く前のフレームを保持しておきます。
+  if (shouldDropByCongestion(accessUnit)) {
+    return;
+  }
+
+  sendAccessUnit(accessUnit, getRtpTimestamp(accessUnit));
+}
+
+uint32_t H264RTPSender::getRtpTimestamp(const H264AccessUnit *accessUnit)
+{
+  return toRtpTimestamp(toMediaTime(accessUnit->dts) + accessUnit->compositionTime);
+}
+
+void H264RTPSender::measureFrame(const H264AccessUnit *accessUnit, bool idr, bool reference, uint64_t nowUs)
+{
+  if (mFrameStatsStartTimeUs == 0) {
+    mFrameStatsStartTimeUs = nowUs;
+  }
+
+  uint32_t size = accessUnit->getSize();
+  if (idr) {
+    mKeyframeBytes += size;
+  } else if (reference) {
+    mReferenceBytes += size;
+  } else {
+    mNonReferenceBytes += size;
+  }
+
+  uint64_t elapsed = nowUs - mFrameStatsStartTimeUs;
+  if (elapsed < H264_FRAME_STATS_WINDOW_US) {
+    return;
+  }
+
+  // キーフレームは GOP ごとにしか来ないので、長めに平滑化しておきます。
+  double keyframeBitrate = (double)mKeyframeBytes * 8.0 * 1000000.0 / elapsed;
+  double referenceBitrate = (double)mReferenceBytes * 8.0 * 1000000.0 / elapsed;
+  double nonReferenceBitrate = (double)mNonReferenceBytes * 8.0 * 1000000.0 / elapsed;
+  if (mKeyframeBitrate == 0 && mReferenceBitrate == 0 && mNonReferenceBitrate == 0) {
+    mKeyframeBitrate = keyframeBitrate;
+    mReferenceBitrate = referenceBitrate;
+    mNonReferenceBitrate = nonReferenceBitrate;
+  } else {
+    mKeyframeBitrate = 0.75 * mKeyframeBitrate + 0.25 * keyframeBitrate;
+    mReferenceBitrate = 0.75 * mReferenceBitrate + 0.25 * referenceBitrate;
+    mNonReferenceBitrate = 0.75 * mNonReferenceBitrate + 0.25 * nonReferenceBitrate;
+  }
+  mFrameStatsStartTimeUs = nowUs;
+  mKeyframeBytes = 0;
+  mReferenceBytes = 0;
+  mNonReferenceBytes = 0;
+}
+
+// 推定ビットレートに収まる段階を求めて、間引きの段階を更新します。
+// 間引きを強くする時はすぐに、弱くする時は余裕がある状態が続いてから 1 段階ずつ変更します。
+void H264RTPSender::updateDropLevel(uint32_t targetBitrate, uint64_t nowUs)
+{
+  double keyframeBitrate = mKeyframeBitrate;
+  double referenceBitrate = keyframeBitrate + mReferenceBitrate;
+  double totalBitrate = referenceBitrate + mNonReferenceBitrate;
+  if (totalBitrate == 0) {
+    return;
+  }
+
+  auto desiredLevel = [&](double bitrate) {
+    if (totalBitrate <= bitrate) {
+      return H264DropNone;
+    } else if (referenceBitrate <= bitrate) {
+      return H264DropNonReference;
+    } else if (keyframeBitrate < bitrate) {
+      return H264DropThinning;
+    }
+    return H264DropKeyframeOnly;
+  };
+
+  H264DropLevel level = mDropLevel;
+  H264DropLevel increaseLevel = desiredLevel(targetBitrate);
+  H264DropLevel decreaseLevel = desiredLevel(targetBitrate / H264_DROP_LEVEL_DECREASE_MARGIN);
+  if (increaseLevel > mDropLevel) {
+    mDropLevelDecreaseTimeUs = 0;
+    if (nowUs - mLastDropLevelChangeTimeUs >= H264_DROP_LEVEL_INCREASE_INTERVAL_US) {
+      level = increaseLevel;
+    }
+  } else if (decreaseLevel < mDropLevel) {
+    if (mDropLevelDecreaseTimeUs == 0) {
+      mDropLevelDecreaseTimeUs = nowUs;
+    } else if (nowUs - mDropLevelDecreaseTimeUs >= H264_DROP_LEVEL_DECREASE_HOLD_US) {
+      mDropLevelDecreaseTimeUs = 0;
+      level = (H264DropLevel)(mDropLevel - 1);
+    }
+  } else {
+    mDropLevelDecreaseTimeUs = 0;
+  }
+
+  if (level != mDropLevel) {
+    LOG_INFO("Change video drop level. ssrc=%u level=%d->%d target=%u bitrate=%.0f dropped=%u\n",
+        mSSRC, mDropLevel, level, targetBitrate, totalBitrate, mCongestionDroppedCount);
+    mDropLevel = level;
+    mLastDropLevelChangeTimeUs = nowUs;
+  }
+}
+
+// 輻輳でフレームを間引く場合には true を返します。
+// IDR は常に送信し、参照フレームを間引いた場合には次の IDR まで送信を止めます。
+bool H264RTPSender::shouldDropByCongestion(const H264AccessUnit *accessUnit)
+{
+  uint32_t targetBitrate = getTargetBitrate();
+  if (targetBitrate == 0) {
+    return false;
+  }
+
+  uint64_t now = TimeUtils::GetMonotonicTimeUs();
+  bool idr = accessUnit->hasIdr();
+  bool reference = !accessUnit->isDiscardable();
+  measureFrame(accessUnit, idr, reference, now);
+  updateDropLevel(targetBitrate, now);
+
+  uint32_t size = accessUnit->getSize();
+  if (idr) {
+    if (mGopStarted) {
+      mLastGopDurationMs = accessUnit->dts - mGopStartDts;
+    }
+    mGopStarted = true;
+    mGopStartDts = accessUnit->dts;
+    mGopSentBytes = size;
+    mThinningWaitingKeyframe = false;
+    return false;
+  }
+
+  bool drop = false;
+  if (mThinningWaitingKeyframe) {
+    drop = true;
+  } else {
+    switch (mDropLevel) {
+      case H264DropNonReference:
+        drop = !reference;
+        break;
+      case H264DropThinning:
+        if (!reference) {
+          drop = true;
+        } else {
+          // 前の GOP の長さの間に推定ビットレートで送信できる分だけ、GOP の先頭から送信します。
+          uint64_t budget = (uint64_t)targetBitrate / 8 * mLastGopDurationMs / 1000;
+          drop = (mLastGopDurationMs == 0 || mGopSentBytes + size > budget);
+        }
+        break;
+      case H264DropKeyframeOnly:
+        drop = true;
+        break;
+      case H264DropNone:
+      default:
+        break;
+    }
+    if (drop && reference) {
+      mThinningWaitingKeyframe = true;
+    }
+  }
+
+  if (drop) {
+    mCongestionDroppedCount++;
+    return true;
+  }
+  mGopSentBytes += size;
+  return false;
+}
+
+// キャッシュしている GOP の送信し直しを開始します。
+// 実際の送信は continueGOPReplay で、アクセスユニットを受信するごとに少しずつ行います。
+bool H264RTPSender::replayGOPCache()
+{
+  if (!mGOPCacheEnabled || !mGOPCache.isValid()) {
+    return false;
+  }
+
+  // 輻輳で参照フレームを間引いている時に GOP をまとめて送信すると輻輳が悪化するので、次の IDR を待ちます。
+  if (mDropLevel >= H264DropThinning) {
+    return false;
+  }
+
+  uint64_t now = TimeUtils::GetMonotonicTimeUs();
+  if (mLastReplayTimeUs != 0 && now - mLastReplayTimeUs < (uint64_t)mKeyframeMinIntervalMs * 1000) {
+    return false;
+  }
+  mLastReplayTimeUs = now;
+
+  LOG_INFO("Replay GOP cache. ssrc=%u frames=%zu\n", mSSRC, mGOPCache.size());
+  mReplaying = true;
+  mReplayIndex = 0;
+  return true;
 }
 
-// TODO: OBS の 出力設定で、tune に zerolatency を設定すると映像が乱れてしまう。
+// GOP キャッシュのアクセスユニットを、最後に受信したアクセスユニットに追いつくまで順番に送信します。
+//
+// 既に受信しているコンシューマーの RTP タイムスタンプが戻らないように、送信し直すアクセスユニットには
+// 最後に送信したタイムスタンプから最後に受信したアクセスユニットのタイムスタンプまでの間を等間隔に割り当てます。
+// 追いついた時の最後のアクセスユニットは、元のタイムスタンプで送信されます。
+// 一度に送信するのは H264_GOP_REPLAY_FRAMES_PER_SEND までにして、パケットはペーサーを通して送信します。
+void H264RTPSender::continueGOPReplay()
+{
+  if (!mGOPCache.isValid() || mReplayIndex >= mGOPCache.size()) {
+    // 送信し直している間にキャッシュが溢れた場合には、送信していないフレームがあるので次の IDR を待ちます。
+    LOG_WARN("GOP cache replay is aborted. ssrc=%u\n", mSSRC);
+    mReplaying = false;
+    mWaitingKeyframe = true;
+    return;
+  }
+
+  size_t last = mGOPCache.size() - 1;
+  uint32_t liveTimestamp = getRtpTimestamp(mGOPCache.get(last));
+  uint32_t baseTimestamp = mHasSentTimestamp ? mLastSentTimestamp : getRtpTimestamp(mGOPCache.get(mReplayIndex)) - 1;
+  int32_t window = (int32_t)(liveTimestamp - baseTimestamp);
+  if (window <= 0) {
+    // 割り当てられるタイムスタンプがないので、次のアクセスユニットを待ちます。
+    return;
+  }
+
+  // 送信するアクセスユニットを選びます。参照されないフレームを間引いている場合には、送信し直しでも間引きます。
+  const H264AccessUnit *accessUnits[H264_GOP_REPLAY_FRAMES_PER_SEND];
+  size_t maxCount = (window < H264_GOP_REPLAY_FRAMES_PER_SEND) ? window : H264_GOP_REPLAY_FRAMES_PER_SEND;
+  size_t count = 0;
+  size_t index = mReplayIndex;
+  while (index <= last && count < maxCount) {
+    const H264AccessUnit *accessUnit = mGOPCache.get(index++);
+    if (mDropLevel >= H264DropNonReference && accessUnit->isDiscardable()) {
+      continue;
+    }
+    accessUnits[count++] = accessUnit;
+  }
+  mReplayIndex = index;
+
+  for (size_t i = 0; i < count; i++) {
+    uint32_t timestamp = baseTimestamp + (uint32_t)((int64_t)window * (i + 1) / count);
+    sendAccessUnit(accessUnits[i], timestamp);
+  }
 
-void H264RTPSender::send(const char *data, const uint32_t dataLen)
+  if (mReplayIndex > last) {
+    LOG_INFO("GOP cache replay is completed. ssrc=%u\n", mSSRC);
+    mReplaying = false;
+  }
+}
+
+void H264RTPSender::sendAccessUnit(const H264AccessUnit *accessUnit, uint32_t timestamp)
 {
-  if (dataLen <= MAXLEN - 2) {
-    sendSingleNalUnitPacket(data, dataLen);
+  // SPS/PPS は小さいので、STAP-A で IDR の前にまとめて送信されます。
+  accessUnit = injectParameterSets(accessUnit);
+
+  // 参照されるフレームを TID=0、捨てられるフレームを TID=1 として frame-marking で通知します。
+  // TID=1 のフレームは TID=0 のフレームだけを参照しています。
+  if (accessUnit->isDiscardable()) {
+    beginFrame(RTP_FRAME_MARKING_DISCARDABLE | RTP_FRAME_MARKING_BASE_LAYER_SYNC, 1, mBaseLayerIndex);
   } else {
-    sendFragmentationUnitsPacket(data, dataLen);
+    mBaseLayerIndex++;
+    beginFrame(accessUnit->hasIdr() ? RTP_FRAME_MARKING_INDEPENDENT : 0, 0, mBaseLayerIndex);
   }
+
+  // 同じアクセスユニットの NAL ユニットは、全て同じタイムスタンプで送信します。
+  mTimestamp = timestamp;
+  if (!mHasSentTimestamp || (int32_t)(timestamp - mLastSentTimestamp) > 0) {
+    mLastSentTimestamp = timestamp;
+    mHasSentTimestamp = true;
+  }
+
+  size_t count = accessUnit->nalUnits.size();
+
+  // STAP-A に詰め込む NAL ユニットはコピーするので、先に必要なサイズを確保しておきます。
+  size_t capacity = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (accessUnit->nalUnits[i].size <= MAXLEN) {
+      capacity += accessUnit->nalUnits[i].size + 3;
+    }
+  }
+  mAggregationBuffer.clear();
+  if (mAggregationBuffer.capacity() < capacity) {
+    mAggregationBuffer.reserve(capacity);
+  }
+
+  size_t i = 0;
+  while (i < count) {
+    const H264NalUnit& nalUnit = accessUnit->nalUnits[i];
+    size_t aggregationCount = countAggregationUnits(accessUnit, i);
+    if (aggregationCount > 1) {
+      bool mark = (i + aggregationCount == count);
+      sendAggregationPacket(accessUnit, i, aggregationCount, mark);
+      i += aggregationCount;
+      continue;
+    }
+
+    bool mark = (i == count - 1);
+    if (nalUnit.size <= MAXLEN - 2) {
+      sendSingleNalUnitPacket(nalUnit.data, nalUnit.size, mark);
+    } else {
+      sendFragmentationUnitsPacket(nalUnit.data, nalUnit.size, mark);
+    }
+    i++;
+  }
+
+  // payload は NAL ユニットを直接参照しているので、呼び出し元に戻る前に送信しておきます。
+  // アクセスユニットのパケットは sendmmsg でまとめて送信されます。
+  flush();
 }
 
 // Single Nal Unit
@@ -38,19 +488,87 @@ void H264RTPSender::send(const char *data, const uint32_t dataLen)
 // |                               :...OPTIONAL RTP padding        |
 // +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
 
-void H264RTPSender::sendSingleNalUnitPacket(const char *data, const uint32_t dataLen)
+void H264RTPSender::sendSingleNalUnitPacket(const char *data, const uint32_t dataLen, bool mark)
 {
-  unsigned char naluHeader = data[0];
-  unsigned char naluType = naluHeader & 0x1F;
-  bool mark = (naluType <= 5);
+  struct iovec iov[1];
+  iov[0].iov_base = (void *)data;
+  iov[0].iov_len = dataLen;
 
-  int status = mSession.SendPacket(data, dataLen, mPayloadType, mark, mark ? mTimestampIncrement : 0);
+  int status = sendPacket(iov, 1, mark, 0);
   if (status < 0) {
     LOG_ERROR("Failed to send Nal unit packet.\n");
     return;
   }
 }
 
+// Single-Time Aggregation Packet type A (STAP-A)
+// 0                   1                   2                   3
+// 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |STAP-A NAL HDR |         NALU 1 Size           | NALU 1 HDR    |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |                         NALU 1 Data                           |
+// :                                                               :
+// +               +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |               | NALU 2 Size                   | NALU 2 HDR    |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |                         NALU 2 Data                           |
+// :                                                               :
+// |                               +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |                               :...OPTIONAL RTP padding        |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+
+// index から始まる NAL ユニットのうち、1 つの STAP-A に詰め込める数を返します。
+size_t H264RTPSender::countAggregationUnits(const H264AccessUnit *accessUnit, size_t index)
+{
+  size_t count = 0;
+  uint32_t len = 1;
+  for (size_t i = index; i < accessUnit->nalUnits.size(); i++) {
+    uint32_t size = accessUnit->nalUnits[i].size;
+    if (len + 2 + size > MAXLEN) {
+      break;
+    }
+    len += 2 + size;
+    count++;
+  }
+  return count;
+}
+
+void H264RTPSender::sendAggregationPacket(const H264AccessUnit *accessUnit, size_t index, size_t count, bool mark)
+{
+  size_t offset = mAggregationBuffer.size();
+
+  // STAP-A の NAL ヘッダーの F ビットは全ての NAL ユニットの OR、
+  // NRI は全ての NAL ユニットの最大値にします。
+  unsigned char forbidden = 0;
+  unsigned char nri = 0;
+  for (size_t i = index; i < index + count; i++) {
+    unsigned char naluHeader = accessUnit->nalUnits[i].data[0];
+    forbidden |= (naluHeader & 0x80);
+    if ((naluHeader & 0x60) > nri) {
+      nri = (naluHeader & 0x60);
+    }
+  }
+  mAggregationBuffer.push_back(forbidden | nri | 24);
+
+  for (size_t i = index; i < index + count; i++) {
+    const H264NalUnit& nalUnit = accessUnit->nalUnits[i];
+    mAggregationBuffer.push_back((nalUnit.size >> 8) & 0xFF);
+    mAggregationBuffer.push_back(nalUnit.size & 0xFF);
+    mAggregationBuffer.insert(mAggregationBuffer.end(), nalUnit.data, nalUnit.data + nalUnit.size);
+  }
+
+  struct iovec iov[1];
+  iov[0].iov_base = &mAggregationBuffer[offset];
+  iov[0].iov_len = mAggregationBuffer.size() - offset;
+
+  int status = sendPacket(iov, 1, mark, 0);
+  if (status < 0) {
+    LOG_ERROR("Failed to send STAP-A packet.\n");
+    return;
+  }
+}
+
 // Fragmentation Units (FUs)
 // 0                   1                   2                   3
 // 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
@@ -71,12 +589,17 @@ void H264RTPSender::sendSingleNalUnitPacket(const char *data, const uint32_t dat
 // |F|NRI|  Type   |S|E|R|  Type   |
 // +---------------+---------------+
 
-void H264RTPSender::sendFragmentationUnitsPacket(const char *data, const uint32_t dataLen)
+void H264RTPSender::sendFragmentationUnitsPacket(const char *data, const uint32_t dataLen, bool mark)
 {
   unsigned char naluHeader = data[0];
   unsigned int rtpLen = dataLen - 1;
 
-  unsigned char rtpBuf[MAXLEN + 100];
+  // FU indicator と FU header は RTP ヘッダーの後ろにコピーして、
+  // FU payload は NAL ユニットを直接参照して送信します。
+  // fuBuf はパケットごとに書き換えるので、バッチからは参照させないでください。
+  uint8_t fuBuf[2];
+  struct iovec iov[1];
+
   unsigned int pi = 0;
   unsigned int num = rtpLen / MAXLEN;
   unsigned int more = rtpLen % MAXLEN;
@@ -97,11 +620,12 @@ void H264RTPSender::sendFragmentationUnitsPacket(const char *data, const uint32_
       fuHeader &= ~0x40;   // bit 6  E
       fuHeader &= ~0x20;   // bit 5  R
 
-      rtpBuf[0] = fuIndicator;
-      rtpBuf[1] = fuHeader;
-      memcpy(&rtpBuf[2], &data[1], MAXLEN);
+      fuBuf[0] = fuIndicator;
+      fuBuf[1] = fuHeader;
+      iov[0].iov_base = (void *)&data[1];
+      iov[0].iov_len = MAXLEN;
 
-      int status = mSession.SendPacket(rtpBuf, MAXLEN + 2, mPayloadType, false, 0);
+      int status = sendPacket(iov, 1, false, 0, fuBuf, 2);
       if (status < 0) {
         LOG_ERROR("Failed to send start of h264 RTP packet.\n");
         return;
@@ -112,11 +636,12 @@ void H264RTPSender::sendFragmentationUnitsPacket(const char *data, const uint32_
       fuHeader |= 0x40;     // bit 6  E
       fuHeader &= ~0x20;    // bit 5  R
 
-      rtpBuf[0] = fuIndicator;
-      rtpBuf[1] = fuHeader;
-      memcpy(&rtpBuf[2], &data[1 + pi * MAXLEN], more);
+      fuBuf[0] = fuIndicator;
+      fuBuf[1] = fuHeader;
+      iov[0].iov_base = (void *)&data[1 + pi * MAXLEN];
+      iov[0].iov_len = more;
 
-      int status = mSession.SendPacket(rtpBuf, more + 2, mPayloadType, true, mTimestampIncrement);
+      int status = sendPacket(iov, 1, mark, 0, fuBuf, 2);
       if (status < 0) {
         LOG_ERROR("Failed to send end of h264 RTP packet.\n");
         return;
@@ -126,11 +651,12 @@ void H264RTPSender::sendFragmentationUnitsPacket(const char *data, const uint32_
       fuHeader &= ~0x40;    // bit 6  E
       fuHeader &= ~0x20;    // bit 5  R
 
-      rtpBuf[0] = fuIndicator;
-      rtpBuf[1] = fuHeader;
-      memcpy(&rtpBuf[2], &data[1 + pi * MAXLEN], MAXLEN);
+      fuBuf[0] = fuIndicator;
+      fuBuf[1] = fuHeader;
+      iov[0].iov_base = (void *)&data[1 + pi * MAXLEN];
+      iov[0].iov_len = MAXLEN;
 
-      int status = mSession.SendPacket(rtpBuf, MAXLEN + 2, mPayloadType, false, 0);
+      int status = sendPacket(iov, 1, false, 0, fuBuf, 2);
       if (status < 0) {
         LOG_ERROR("Failed to send middle of h264 RTP packet.\n");
         return;
@@ -1,17 +1,112 @@
 #pragma once
 
+#include <atomic>
+
+#include "H264GOPCache.h"
 #include "RTPSender.h"
+#include "../codec/h264/H264AccessUnit.h"
+
+// 輻輳時にフレームを間引く段階
+typedef enum {
+  // 全てのフレームを送信します。
+  H264DropNone,
+  // 参照されないフレームを間引きます。
+  H264DropNonReference,
+  // GOP の途中から次の IDR までのフレームを間引いて、推定ビットレートに収まるようにします。
+  H264DropThinning,
+  // IDR だけを送信します。
+  H264DropKeyframeOnly
+} H264DropLevel;
 
 class H264RTPSender : public RTPSender {
 private:
-  uint32_t mFps;
+  // STAP-A のパケットを作成するバッファ
+  // 送信するまで参照されるので、アクセスユニットの送信中は再確保しないようにします。
+  std::vector<uint8_t> mAggregationBuffer;
+  // シーケンスヘッダーで受信した SPS/PPS
+  std::vector<std::vector<uint8_t>> mSequenceParameterSets;
+  std::vector<std::vector<uint8_t>> mPictureParameterSets;
+  // SPS/PPS を挿入したアクセスユニット
+  H264AccessUnit mInjectedAccessUnit;
+
+  // PLI/FIR を受信した時に送信し直す GOP
+  H264GOPCache mGOPCache;
+  bool mGOPCacheEnabled;
+  // GOP を送信し直す最小間隔 (ミリ秒)
+  uint32_t mKeyframeMinIntervalMs;
+  uint64_t mLastReplayTimeUs;
+  // GOP キャッシュを送信し直している途中か、次に送信するキャッシュの位置
+  bool mReplaying;
+  size_t mReplayIndex;
+  // これまでに送信した最大の RTP タイムスタンプ
+  uint32_t mLastSentTimestamp;
+  bool mHasSentTimestamp;
+  // RTCP の受信スレッドや配信の再開時に設定され、送信スレッドで処理されます。
+  std::atomic<bool> mKeyframeRequested;
+  std::atomic<bool> mRestartRequested;
+  // キーフレームを受信するまで映像の送信を止めているか
+  bool mWaitingKeyframe;
+  uint32_t mDroppedCount;
+
+  // frame-marking の TL0PICIDX (TID=0 のフレームごとに増やします)
+  uint8_t mBaseLayerIndex;
+
+  // 輻輳時のフレームの間引き
+  H264DropLevel mDropLevel;
+  uint64_t mLastDropLevelChangeTimeUs;
+  // 下げられる段階が続いている時間を計測する開始時刻
+  uint64_t mDropLevelDecreaseTimeUs;
+  // 参照フレームを間引いたので、次の IDR まで送信を止めているか
+  bool mThinningWaitingKeyframe;
+  uint32_t mCongestionDroppedCount;
+  // GOP ごとの送信量
+  bool mGopStarted;
+  uint32_t mGopStartDts;
+  uint32_t mLastGopDurationMs;
+  uint64_t mGopSentBytes;
+  // フレームの種類ごとの入力ビットレートの計測
+  uint64_t mFrameStatsStartTimeUs;
+  uint64_t mKeyframeBytes;
+  uint64_t mReferenceBytes;
+  uint64_t mNonReferenceBytes;
+  double mKeyframeBitrate;
+  double mReferenceBitrate;
+  double mNonReferenceBitrate;
 
-  void sendSingleNalUnitPacket(const char *buf, const uint32_t len);
-  void sendFragmentationUnitsPacket(const char *buf, const uint32_t len);
+  const H264AccessUnit *injectParameterSets(const H264AccessUnit *accessUnit);
+  uint32_t getRtpTimestamp(const H264AccessUnit *accessUnit);
+  void sendAccessUnit(const H264AccessUnit *accessUnit, uint32_t timestamp);
+  bool replayGOPCache();
+  void continueGOPReplay();
+  void measureFrame(const H264AccessUnit *accessUnit, bool idr, bool reference, uint64_t nowUs);
+  void updateDropLevel(uint32_t targetBitrate, uint64_t nowUs);
+  bool shouldDropByCongestion(const H264AccessUnit *accessUnit);
+
+  size_t countAggregationUnits(const H264AccessUnit *accessUnit, size_t index);
+  void sendAggregationPacket(const H264AccessUnit *accessUnit, size_t index, size_t count, bool mark);
+  void sendSingleNalUnitPacket(const char *buf, const uint32_t len, bool mark);
+  void sendFragmentationUnitsPacket(const char *buf, const uint32_t len, bool mark);
 
 public:
   H264RTPSender();
   virtual ~H264RTPSender();
 
-  virtual void send(const char *data, const uint32_t dataLen) override;
+  // アクセスユニットを RTP パケットに分割して送信します。
+  // RTP タイムスタンプは DTS + CompositionTime から計算し、最後の NAL ユニットにマーカーを付けます。
+  void send(const H264AccessUnit *accessUnit);
+
+  // IDR の前に挿入する SPS/PPS を設定します。
+  // SPS/PPS を含まない IDR を送信する場合には、自動的に SPS/PPS を先頭に付けて送信します。
+  void setParameterSets(const std::vector<std::vector<uint8_t>>& sps, const std::vector<std::vector<uint8_t>>& pps);
+
+  // GOP キャッシュの設定を行います。
+  // minInterval はキャッシュを送信し直す最小間隔 (ミリ秒) です。
+  void setGOPCache(bool enabled, size_t maxBytes, uint32_t minInterval);
+
+  // 配信が再開された時に呼び出します。
+  // 古い GOP キャッシュを破棄して、次のキーフレームまで映像の送信を止めます。
+  void waitForKeyframe();
+
+protected:
+  virtual void onKeyframeRequested() override;
 };
@@ -0,0 +1,48 @@
+#include "MediaClock.h"
+#include "../utils/TimeUtils.h"
+
+MediaClock::MediaClock()
+{
+  mAnchored = false;
+  mStarted = false;
+  mEpochTimeUs = 0;
+  mRtmpBaseMs = 0;
+  mMediaBaseMs = 0;
+}
+
+MediaClock::~MediaClock()
+{
+}
+
+int64_t MediaClock::toMediaTime(uint32_t rtmpTimestamp)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  if (!mAnchored) {
+    uint64_t now = TimeUtils::GetWallClockTimeUs();
+    if (!mStarted) {
+      mEpochTimeUs = now;
+      mStarted = true;
+    }
+    mRtmpBaseMs = rtmpTimestamp;
+    mMediaBaseMs = (now - mEpochTimeUs) / 1000;
+    mAnchored = true;
+  }
+  // RTMP のタイムスタンプは 32 bit で一周するので、差分を符号付きで計算します。
+  return mMediaBaseMs + (int32_t)(rtmpTimestamp - mRtmpBaseMs);
+}
+
+bool MediaClock::getMediaTimeAt(uint64_t wallClockTimeUs, int64_t *mediaTimeUs)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  if (!mStarted) {
+    return false;
+  }
+  *mediaTimeUs = (int64_t)(wallClockTimeUs - mEpochTimeUs);
+  return true;
+}
+
+void MediaClock::reset()
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  mAnchored = false;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <mutex>
+
+// 同じストリームの映像と音声で共有する時計です。
+//
+// RTMP のタイムスタンプ (ミリ秒) をメディア時刻に変換し、メディア時刻 0 を
+// 最初にタイムスタンプを受信した時の wallclock に対応させます。
+// 映像と音声の RTP タイムスタンプと RTCP SR の NTP タイムスタンプは、すべてこの時計から計算するので、
+// 受信側で映像と音声の同期を取ることができます。
+//
+// 配信が再開された時には RTMP のタイムスタンプが 0 から始まり直すので、reset を呼び出してください。
+// メディア時刻は再開した時の wallclock から続けるので、RTP タイムスタンプは巻き戻りません。
+class MediaClock {
+private:
+  std::mutex mMutex;
+  bool mAnchored;
+  bool mStarted;
+  // メディア時刻 0 に対応する wallclock (マイクロ秒)
+  uint64_t mEpochTimeUs;
+  // 基準にしている RTMP のタイムスタンプとメディア時刻
+  uint32_t mRtmpBaseMs;
+  int64_t mMediaBaseMs;
+
+public:
+  MediaClock();
+  virtual ~MediaClock();
+
+  // RTMP のタイムスタンプをメディア時刻 (ミリ秒) に変換します。
+  int64_t toMediaTime(uint32_t rtmpTimestamp);
+
+  // 現在の wallclock (マイクロ秒) に対応するメディア時刻をマイクロ秒で返します。
+  // まだタイムスタンプを受信していない場合には false を返します。
+  bool getMediaTimeAt(uint64_t wallClockTimeUs, int64_t *mediaTimeUs);
+
+  void reset();
+};
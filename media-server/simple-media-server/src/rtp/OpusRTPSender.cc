@@ -6,19 +6,51 @@ OpusRTPSender::OpusRTPSender()
 {
   mPayloadType = 100;
   mFrequency = 48000.0;
-  // Open のフレームサイズを 960 にしているので、ここでも 960 にしておきます。
+  // 1 フレームあたりのタイムスタンプの増分です。
+  // フレーム長を変更する場合には setTimestampIncrement で設定し直します。
   mTimestampIncrement = 960;
+  mTimestampSynced = false;
+  mTimestampBase = 0;
 }
 
 OpusRTPSender::~OpusRTPSender()
 {
+  // RTCP の受信スレッドから派生クラスの仮想関数が呼び出されないように、
+  // 派生クラスのメンバーが破棄される前にソケットから登録を解除します。
+  close();
 }
 
-void OpusRTPSender::send(const char *data, const uint32_t dataLen)
+void OpusRTPSender::setTimeline(uint32_t anchorTimestamp, int64_t anchorPosition)
 {
-  int status = mSession.SendPacket(data, dataLen, mPayloadType, true, mTimestampIncrement);
+  // サンプルの位置はクロックレート (48 kHz) と同じ単位なので、そのまま RTP タイムスタンプの差になります。
+  uint32_t anchor = toRtpTimestamp(toMediaTime(anchorTimestamp));
+  uint32_t base = anchor - (uint32_t)anchorPosition;
+  if (mTimestampSynced) {
+    LOG_INFO("Resync opus rtp timestamp. ssrc=%u diff=%dms\n", mSSRC, (int32_t)((int32_t)(base - mTimestampBase) * 1000 / mFrequency));
+  }
+  mTimestampBase = base;
+  mTimestampSynced = true;
+}
+
+void OpusRTPSender::send(const char *data, const uint32_t dataLen, int64_t position, uint32_t frameCount)
+{
+  if (!mTimestampSynced) {
+    return;
+  }
+
+  // AAC と Opus のフレームサイズが異なり、欠落も無音で埋めているので、
+  // RTP タイムスタンプはサンプル数から求めた位置に合わせます。
+  mTimestamp = mTimestampBase + (uint32_t)position;
+  uint32_t increment = mTimestampIncrement * frameCount;
+
+  struct iovec iov[1];
+  iov[0].iov_base = (void *)data;
+  iov[0].iov_len = dataLen;
+
+  int status = sendPacket(iov, 1, true, increment);
   if (status < 0) {
     LOG_ERROR("Failed to send a opus rtp packet. dstIP=%d.%d.%d.%d:%d\n", mDestIP[0],mDestIP[1],mDestIP[2],mDestIP[3],mDestPort);
     return;
   }
+  flush();
 }
@@ -3,9 +3,18 @@
 #include "RTPSender.h"
 
 class OpusRTPSender : public RTPSender {
+private:
+  bool mTimestampSynced;
+  // サンプルの位置 0 に対応する RTP タイムスタンプ
+  uint32_t mTimestampBase;
+
 public:
   OpusRTPSender();
   virtual ~OpusRTPSender();
 
-  virtual void send(const char *data, const uint32_t dataLen) override;
+  // サンプルの位置 anchorPosition (48 kHz のサンプル数) を RTMP のタイムスタンプ anchorTimestamp (ミリ秒) に対応させます。
+  // 以降のパケットの RTP タイムスタンプは、サンプルの位置から計算します。
+  void setTimeline(uint32_t anchorTimestamp, int64_t anchorPosition);
+  // position にはパケットの先頭のサンプルの位置を、frameCount にはパケットに含まれるフレーム数を指定します。
+  void send(const char *data, const uint32_t dataLen, int64_t position, uint32_t frameCount);
 };
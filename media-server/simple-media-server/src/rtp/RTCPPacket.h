@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+
+// see https://tex2e.github.io/rfc-translater/html/rfc3550.html
+// see https://tex2e.github.io/rfc-translater/html/rfc4585.html
+
+// RTCP のパケットタイプ
+#define RTCP_PT_SR 200
+#define RTCP_PT_RR 201
+#define RTCP_PT_SDES 202
+#define RTCP_PT_BYE 203
+#define RTCP_PT_RTPFB 205
+#define RTCP_PT_PSFB 206
+
+// RTPFB の FMT
+#define RTCP_RTPFB_FMT_NACK 1
+#define RTCP_RTPFB_FMT_TRANSPORT_CC 15
+
+// PSFB の FMT
+#define RTCP_PSFB_FMT_PLI 1
+#define RTCP_PSFB_FMT_FIR 4
+
+// RTCP Common Header
+// 0                   1                   2                   3
+// 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |V=2|P|    RC   |       PT      |             length            |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+#define RTCP_HEADER_LEN 4
+
+class RTCPUtils {
+private:
+  RTCPUtils() {}
+
+public:
+  static inline uint16_t readUint16(const uint8_t *p) {
+    return ((uint16_t)p[0] << 8) | p[1];
+  }
+
+  static inline uint32_t readUint32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+  }
+
+  static inline void writeUint16(uint8_t *p, uint16_t value) {
+    p[0] = (value >> 8) & 0xFF;
+    p[1] = value & 0xFF;
+  }
+
+  static inline void writeUint32(uint8_t *p, uint32_t value) {
+    p[0] = (value >> 24) & 0xFF;
+    p[1] = (value >> 16) & 0xFF;
+    p[2] = (value >> 8) & 0xFF;
+    p[3] = value & 0xFF;
+  }
+
+  // compound packet に含まれる RTCP パケットの種類 (RC/FMT)
+  static inline uint8_t getCount(const uint8_t *p) {
+    return p[0] & 0x1F;
+  }
+
+  static inline uint8_t getPayloadType(const uint8_t *p) {
+    return p[1];
+  }
+
+  // rtcp-mux で RTP と RTCP を見分けます。(RFC 5761)
+  // RTCP のパケットタイプは 192〜223 の範囲になります。
+  static inline bool isRtcp(const uint8_t *p, uint32_t len) {
+    return len >= RTCP_HEADER_LEN && (p[0] >> 6) == 2 && p[1] >= 192 && p[1] <= 223;
+  }
+
+  // ヘッダーを含めた RTCP パケットのバイト数
+  static inline uint32_t getPacketSize(const uint8_t *p) {
+    return (readUint16(&p[2]) + 1) * 4;
+  }
+};
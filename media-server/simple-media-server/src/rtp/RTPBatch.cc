@@ -0,0 +1,297 @@
+#include "RTPBatch.h"
+#include "../utils/Log.h"
+#include <errno.h>
+#include <string.h>
+#include <netinet/udp.h>
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+#define RTP_GSO_CONTROL_SIZE CMSG_SPACE(sizeof(uint16_t))
+// UDP GSO での送信がこの回数続けて失敗した場合には、NIC やドライバが対応していないとみなして、
+// 以降は UDP GSO を使用しません。
+#define RTP_GSO_MAX_FAILURES 8
+
+RTPBatch::RTPBatch()
+{
+  mSocket = -1;
+  mMaxBatchSize = 0;
+  mCount = 0;
+  mGsoRequested = false;
+  mGsoEnabled = false;
+  mGsoFailures = 0;
+  setMaxBatchSize(RTP_BATCH_DEFAULT_SIZE);
+}
+
+RTPBatch::~RTPBatch()
+{
+}
+
+void RTPBatch::setSocket(int sockfd)
+{
+  mSocket = sockfd;
+  setGsoEnabled(mGsoRequested);
+}
+
+void RTPBatch::setMaxBatchSize(int size)
+{
+  if (size < 1) {
+    size = 1;
+  } else if (size > RTP_BATCH_MAX_SIZE) {
+    size = RTP_BATCH_MAX_SIZE;
+  }
+
+  if (mCount > 0) {
+    flush();
+  }
+
+  mMaxBatchSize = size;
+  mMessages.resize(size);
+  mIovecs.resize(size * RTP_MAX_IOV);
+  mHeaders.resize(size * RTP_BATCH_HEADER_SIZE);
+  mAddrs.resize(size);
+  mGsoMessages.resize(size);
+  mGsoIovecs.resize(size * RTP_MAX_IOV);
+  mGsoControls.resize(size * RTP_GSO_CONTROL_SIZE);
+  mGsoFirstIndex.resize(size);
+}
+
+int RTPBatch::getMaxBatchSize()
+{
+  return mMaxBatchSize;
+}
+
+void RTPBatch::setGsoEnabled(bool enabled)
+{
+  mGsoRequested = enabled;
+  mGsoEnabled = false;
+  mGsoFailures = 0;
+
+  if (!enabled || mSocket < 0) {
+    return;
+  }
+
+  // UDP_SEGMENT を取得できるかでカーネルが UDP GSO に対応しているか確認します。
+  int value = 0;
+  socklen_t len = sizeof(value);
+  if (getsockopt(mSocket, SOL_UDP, UDP_SEGMENT, &value, &len) == 0) {
+    mGsoEnabled = true;
+  } else {
+    LOG_INFO("UDP GSO is not supported. error=%s\n", strerror(errno));
+  }
+}
+
+bool RTPBatch::isGsoEnabled()
+{
+  return mGsoEnabled;
+}
+
+uint8_t *RTPBatch::add(const struct sockaddr_in *dest, const struct iovec *payload, int payloadCount, uint32_t headerLen,
+    const uint8_t *payloadHeader, uint32_t payloadHeaderLen)
+{
+  if (payloadCount > RTP_MAX_IOV - 1) {
+    LOG_ERROR("Too many iovec. payloadCount=%d\n", payloadCount);
+    return nullptr;
+  }
+
+  if (headerLen > RTP_MAX_HEADER_LEN) {
+    LOG_ERROR("RTP header is too long. headerLen=%u\n", headerLen);
+    return nullptr;
+  }
+
+  if (payloadHeaderLen > RTP_MAX_PAYLOAD_HEADER_LEN) {
+    LOG_ERROR("RTP payload header is too long. payloadHeaderLen=%u\n", payloadHeaderLen);
+    return nullptr;
+  }
+
+  if (mCount >= mMaxBatchSize) {
+    flush();
+  }
+
+  int index = mCount++;
+  uint8_t *header = &mHeaders[index * RTP_BATCH_HEADER_SIZE];
+  if (payloadHeaderLen > 0) {
+    memcpy(&header[headerLen], payloadHeader, payloadHeaderLen);
+  }
+  struct iovec *iov = &mIovecs[index * RTP_MAX_IOV];
+  iov[0].iov_base = header;
+  iov[0].iov_len = headerLen + payloadHeaderLen;
+  for (int i = 0; i < payloadCount; i++) {
+    iov[i + 1] = payload[i];
+  }
+
+  mAddrs[index] = *dest;
+
+  struct mmsghdr *msg = &mMessages[index];
+  memset(msg, 0, sizeof(struct mmsghdr));
+  msg->msg_hdr.msg_name = &mAddrs[index];
+  msg->msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+  msg->msg_hdr.msg_iov = iov;
+  msg->msg_hdr.msg_iovlen = payloadCount + 1;
+
+  return header;
+}
+
+int RTPBatch::flush()
+{
+  if (mCount == 0) {
+    return 0;
+  }
+
+  if (mSocket < 0) {
+    mCount = 0;
+    return -1;
+  }
+
+  int sent = 0;
+  if (mGsoEnabled && mCount > 1) {
+    sent = sendSegmentedMessages();
+  } else {
+    sent = sendMessages(0);
+  }
+
+  mCount = 0;
+  return sent;
+}
+
+size_t RTPBatch::getMessageLength(int index)
+{
+  const struct msghdr *hdr = &mMessages[index].msg_hdr;
+  size_t len = 0;
+  for (size_t i = 0; i < hdr->msg_iovlen; i++) {
+    len += hdr->msg_iov[i].iov_len;
+  }
+  return len;
+}
+
+bool RTPBatch::isSameDestination(int index1, int index2)
+{
+  return mAddrs[index1].sin_addr.s_addr == mAddrs[index2].sin_addr.s_addr &&
+         mAddrs[index1].sin_port == mAddrs[index2].sin_port;
+}
+
+int RTPBatch::sendMessages(int first)
+{
+  int sent = first;
+  while (sent < mCount) {
+    int ret = sendmmsg(mSocket, &mMessages[sent], mCount - sent, 0);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      LOG_ERROR("Failed to send a rtp packet. error=%s\n", strerror(errno));
+      // 先頭のパケットが送信できなかったので、破棄して次のパケットから送信します。
+      sent++;
+      continue;
+    }
+    sent += ret;
+  }
+  return sent - first;
+}
+
+int RTPBatch::sendSegmentedMessages()
+{
+  int groupCount = 0;
+  int iovIndex = 0;
+  int index = 0;
+
+  // 同じ宛先で同じサイズのパケットが連続している部分を 1 つのメッセージにまとめます。
+  while (index < mCount) {
+    size_t segmentSize = getMessageLength(index);
+    size_t totalSize = segmentSize;
+    int segments = 1;
+    while (index + segments < mCount && segments < RTP_GSO_MAX_SEGMENTS) {
+      int next = index + segments;
+      size_t len = getMessageLength(next);
+      if (len > segmentSize || !isSameDestination(index, next) || totalSize + len > RTP_GSO_MAX_BYTES) {
+        break;
+      }
+      totalSize += len;
+      segments++;
+      if (len < segmentSize) {
+        // 小さいセグメントは最後にしか置けません。
+        break;
+      }
+    }
+
+    struct mmsghdr *out = &mGsoMessages[groupCount];
+    mGsoFirstIndex[groupCount] = index;
+
+    if (segments == 1) {
+      *out = mMessages[index];
+    } else {
+      memset(out, 0, sizeof(struct mmsghdr));
+      struct iovec *iov = &mGsoIovecs[iovIndex];
+      int iovCount = 0;
+      for (int i = 0; i < segments; i++) {
+        const struct msghdr *hdr = &mMessages[index + i].msg_hdr;
+        for (size_t j = 0; j < hdr->msg_iovlen; j++) {
+          iov[iovCount++] = hdr->msg_iov[j];
+        }
+      }
+      iovIndex += iovCount;
+
+      uint8_t *control = &mGsoControls[groupCount * RTP_GSO_CONTROL_SIZE];
+      memset(control, 0, RTP_GSO_CONTROL_SIZE);
+
+      out->msg_hdr.msg_name = &mAddrs[index];
+      out->msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+      out->msg_hdr.msg_iov = iov;
+      out->msg_hdr.msg_iovlen = iovCount;
+      out->msg_hdr.msg_control = control;
+      out->msg_hdr.msg_controllen = RTP_GSO_CONTROL_SIZE;
+
+      struct cmsghdr *cm = CMSG_FIRSTHDR(&out->msg_hdr);
+      cm->cmsg_level = SOL_UDP;
+      cm->cmsg_type = UDP_SEGMENT;
+      cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+      uint16_t gsoSize = segmentSize;
+      memcpy(CMSG_DATA(cm), &gsoSize, sizeof(gsoSize));
+    }
+
+    groupCount++;
+    index += segments;
+  }
+
+  int sentGroups = 0;
+  int sent = 0;
+  while (sentGroups < groupCount) {
+    int ret = sendmmsg(mSocket, &mGsoMessages[sentGroups], groupCount - sentGroups, 0);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      if (mGsoMessages[sentGroups].msg_hdr.msg_controllen > 0 &&
+          (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP)) {
+        // EINVAL などは UDP GSO 以外の原因でも返されるので、このバッチの残りだけを通常の送信に切り替えます。
+        // 続けて失敗する場合には、NIC やドライバが UDP GSO に対応していないとみなして使用を止めます。
+        mGsoFailures++;
+        if (mGsoFailures >= RTP_GSO_MAX_FAILURES) {
+          LOG_WARN("Failed to send with UDP GSO repeatedly, disable UDP GSO. error=%s\n", strerror(errno));
+          mGsoEnabled = false;
+        } else {
+          LOG_WARN("Failed to send with UDP GSO, fall back to sendmmsg for this batch. error=%s\n", strerror(errno));
+        }
+        return sent + sendMessages(mGsoFirstIndex[sentGroups]);
+      }
+
+      LOG_ERROR("Failed to send a rtp packet. error=%s\n", strerror(errno));
+      ret = 1;
+    } else {
+      mGsoFailures = 0;
+      for (int i = 0; i < ret; i++) {
+        int first = mGsoFirstIndex[sentGroups + i];
+        int last = (sentGroups + i + 1 < groupCount) ? mGsoFirstIndex[sentGroups + i + 1] : mCount;
+        sent += last - first;
+      }
+    }
+    sentGroups += ret;
+  }
+  return sent;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <vector>
+
+#include "RTPPacket.h"
+
+// sendmmsg で一度に送信する RTP パケット数
+#define RTP_BATCH_DEFAULT_SIZE 32
+// sendmmsg の vlen の上限 (UIO_MAXIOV)
+#define RTP_BATCH_MAX_SIZE 1024
+// 1 パケットに含めることができる iovec の最大数 (RTP ヘッダーを含む)
+#define RTP_MAX_IOV 4
+// RTP ヘッダーの後ろに続けてコピーできるペイロードヘッダーの最大長 (FU-A の FU indicator と FU header など)
+#define RTP_MAX_PAYLOAD_HEADER_LEN 4
+// 1 パケットごとに確保するヘッダー用バッファのサイズ
+#define RTP_BATCH_HEADER_SIZE (RTP_MAX_HEADER_LEN + RTP_MAX_PAYLOAD_HEADER_LEN)
+// UDP GSO で 1 回にまとめることができるセグメント数 (カーネルの UDP_MAX_SEGMENTS)
+#define RTP_GSO_MAX_SEGMENTS 64
+// UDP GSO で 1 回にまとめることができる最大バイト数 (UDP ペイロードの上限以下)
+#define RTP_GSO_MAX_BYTES 64000
+
+// 複数の RTP パケットを溜めておき、sendmmsg でまとめて送信します。
+// payload は呼び出し元のバッファを直接参照するので、flush するまで解放しないでください。
+//
+// UDP GSO (UDP_SEGMENT) が使用できる場合には、同じ宛先で同じサイズのパケットが連続している部分を
+// 1 つの大きなバッファとしてカーネルに渡し、カーネル (または NIC) でパケットに分割してもらいます。
+// 最後のセグメントだけは小さくても構いません。
+class RTPBatch {
+private:
+  int mSocket;
+  int mMaxBatchSize;
+  int mCount;
+  std::vector<struct mmsghdr> mMessages;
+  std::vector<struct iovec> mIovecs;
+  std::vector<uint8_t> mHeaders;
+  std::vector<struct sockaddr_in> mAddrs;
+
+  bool mGsoRequested;
+  bool mGsoEnabled;
+  // UDP GSO での送信が続けて失敗した回数
+  int mGsoFailures;
+  std::vector<struct mmsghdr> mGsoMessages;
+  std::vector<struct iovec> mGsoIovecs;
+  std::vector<uint8_t> mGsoControls;
+  std::vector<int> mGsoFirstIndex;
+
+  size_t getMessageLength(int index);
+  bool isSameDestination(int index1, int index2);
+  int sendMessages(int first);
+  int sendSegmentedMessages();
+
+public:
+  RTPBatch();
+  virtual ~RTPBatch();
+
+  void setSocket(int sockfd);
+  void setMaxBatchSize(int size);
+  int getMaxBatchSize();
+  // UDP GSO を使用するか設定します。カーネルが対応していない場合には無視されます。
+  void setGsoEnabled(bool enabled);
+  bool isGsoEnabled();
+
+  bool empty() {
+    return mCount == 0;
+  }
+
+  int size() {
+    return mCount;
+  }
+
+  // パケットを追加して、RTP ヘッダーを書き込むバッファを返却します。
+  // ヘッダー用のバッファは RTP_BATCH_HEADER_SIZE ずつ事前に確保しているので、headerLen は RTP_MAX_HEADER_LEN 以下にしてください。
+  // payloadHeader は RTP ヘッダーの直後にコピーされるので、呼び出し元のバッファは flush を待たずに解放できます。
+  // バッチが一杯の場合には、先に溜まっているパケットを送信します。
+  uint8_t *add(const struct sockaddr_in *dest, const struct iovec *payload, int payloadCount, uint32_t headerLen,
+      const uint8_t *payloadHeader = nullptr, uint32_t payloadHeaderLen = 0);
+  int flush();
+};
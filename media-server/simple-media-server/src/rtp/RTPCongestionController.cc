@@ -0,0 +1,409 @@
+#include <math.h>
+#include "RTPCongestionController.h"
+#include "RTCPPacket.h"
+#include "../utils/Log.h"
+#include "../utils/TimeUtils.h"
+
+// see https://datatracker.ietf.org/doc/html/draft-holmer-rmcat-transport-wide-cc-extensions-01
+// see https://datatracker.ietf.org/doc/html/draft-ietf-rmcat-gcc-02
+
+// 同じグループとして扱う送信時刻の範囲
+#define RTP_CC_BURST_TIME_US 5000
+// 遅延勾配を求めるのに使用するグループ数
+#define RTP_CC_TRENDLINE_WINDOW 20
+#define RTP_CC_TRENDLINE_SMOOTHING 0.9
+#define RTP_CC_TRENDLINE_GAIN 4.0
+// 過負荷と判断するまでの時間 (ミリ秒)
+#define RTP_CC_OVERUSE_TIME_MS 10.0
+// 推定ビットレートを下げる時の倍率と最小間隔
+#define RTP_CC_DECREASE_FACTOR 0.85
+#define RTP_CC_DECREASE_INTERVAL_US 200000
+// 推定ビットレートを上げる時の 1 秒あたりの倍率
+#define RTP_CC_INCREASE_FACTOR 1.08
+// この割合以上のパケットロスがある場合にはビットレートを下げます。
+#define RTP_CC_LOSS_THRESHOLD 0.1
+// 受信されたビットレートを計測する間隔
+#define RTP_CC_ACKED_WINDOW_US 500000
+
+// transport-cc feedback
+// 0                   1                   2                   3
+// 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |V=2|P|  FMT=15 |    PT=205     |           length              |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |                     SSRC of packet sender                     |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |                      SSRC of media source                     |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |      base sequence number     |      packet status count      |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |                 reference time                | fb pkt. count |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |          packet chunk         |         packet chunk          |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// .                                                               .
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |         packet chunk          |  recv delta   |  recv delta   |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// .                                                               .
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+#define RTCP_TRANSPORT_CC_HEADER_LEN 20
+
+// packet chunk の status symbol
+#define RTCP_TRANSPORT_CC_NOT_RECEIVED 0
+#define RTCP_TRANSPORT_CC_SMALL_DELTA 1
+#define RTCP_TRANSPORT_CC_LARGE_DELTA 2
+
+RTPCongestionController::RTPCongestionController()
+{
+  mSentPackets.resize(RTP_CC_HISTORY_SIZE);
+  mSymbols.resize(0x10000);
+  mMinBitrate = 100000;
+  mMaxBitrate = 20000000;
+  reset();
+}
+
+RTPCongestionController::~RTPCongestionController()
+{
+}
+
+void RTPCongestionController::setBitrateRange(uint32_t minBitrate, uint32_t maxBitrate)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  mMinBitrate = minBitrate;
+  mMaxBitrate = (maxBitrate > minBitrate) ? maxBitrate : minBitrate;
+  mTargetBitrate = mMaxBitrate;
+}
+
+void RTPCongestionController::reset()
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  for (auto& packet : mSentPackets) {
+    packet.valid = false;
+  }
+  mTargetBitrate = mMaxBitrate;
+  mCurrentGroup = RTPPacketGroup();
+  mPreviousGroup = RTPPacketGroup();
+  mAccumulatedDelayMs = 0;
+  mSmoothedDelayMs = 0;
+  mFirstArrivalTimeUs = -1;
+  mDelayHistory.clear();
+  mDeltaCount = 0;
+  mPreviousTrend = 0;
+  mThreshold = 12.5;
+  mTimeOverUsingMs = -1;
+  mOverUseCounter = 0;
+  mLastThresholdUpdateTimeUs = -1;
+  mUsage = RTPBandwidthNormal;
+  mAckedWindowStartUs = -1;
+  mAckedWindowBytes = 0;
+  mAckedBitrate = 0;
+  mLossFraction = 0;
+  mLastUpdateTimeUs = 0;
+  mLastDecreaseTimeUs = 0;
+}
+
+void RTPCongestionController::onPacketSent(uint16_t transportSequenceNumber, uint32_t size, uint64_t sendTimeUs)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  RTPSentPacketInfo& packet = mSentPackets[transportSequenceNumber & (RTP_CC_HISTORY_SIZE - 1)];
+  packet.transportSequenceNumber = transportSequenceNumber;
+  packet.size = size;
+  packet.sendTimeUs = sendTimeUs;
+  packet.valid = true;
+}
+
+void RTPCongestionController::onTransportFeedback(const uint8_t *data, uint32_t len)
+{
+  if (len < RTCP_TRANSPORT_CC_HEADER_LEN) {
+    return;
+  }
+
+  uint16_t baseSequenceNumber = RTCPUtils::readUint16(&data[12]);
+  uint16_t statusCount = RTCPUtils::readUint16(&data[14]);
+  // reference time は 64 ミリ秒単位の 24 bit の符号付き整数です。
+  int32_t referenceTime = (data[16] << 16) | (data[17] << 8) | data[18];
+  if (referenceTime & 0x800000) {
+    referenceTime -= 0x1000000;
+  }
+
+  std::lock_guard<std::mutex> lock(mMutex);
+
+  // packet chunk を展開して、パケットごとの status symbol を取り出します。
+  uint8_t *symbols = mSymbols.data();
+  uint32_t symbolCount = 0;
+  uint32_t offset = RTCP_TRANSPORT_CC_HEADER_LEN;
+  while (symbolCount < statusCount && offset + 2 <= len) {
+    uint16_t chunk = RTCPUtils::readUint16(&data[offset]);
+    offset += 2;
+    if ((chunk & 0x8000) == 0) {
+      // Run Length Chunk
+      uint8_t symbol = (chunk >> 13) & 0x03;
+      uint16_t runLength = chunk & 0x1FFF;
+      for (uint16_t i = 0; i < runLength && symbolCount < statusCount; i++) {
+        symbols[symbolCount++] = symbol;
+      }
+    } else if ((chunk & 0x4000) == 0) {
+      // Status Vector Chunk (1 bit x 14)
+      for (int i = 0; i < 14 && symbolCount < statusCount; i++) {
+        symbols[symbolCount++] = (chunk >> (13 - i)) & 0x01;
+      }
+    } else {
+      // Status Vector Chunk (2 bit x 7)
+      for (int i = 0; i < 7 && symbolCount < statusCount; i++) {
+        symbols[symbolCount++] = (chunk >> (12 - 2 * i)) & 0x03;
+      }
+    }
+  }
+  if (symbolCount < statusCount) {
+    LOG_WARN("Invalid transport-cc feedback. len=%u statusCount=%u\n", len, statusCount);
+    return;
+  }
+
+  // recv delta は 250 マイクロ秒単位で、直前のパケットからの差分です。
+  int64_t arrivalTimeUs = (int64_t)referenceTime * 64000;
+  uint32_t lostCount = 0;
+  for (uint32_t i = 0; i < symbolCount; i++) {
+    uint16_t sequenceNumber = baseSequenceNumber + i;
+    uint8_t symbol = symbols[i];
+    if (symbol == RTCP_TRANSPORT_CC_NOT_RECEIVED) {
+      lostCount++;
+      continue;
+    } else if (symbol == RTCP_TRANSPORT_CC_SMALL_DELTA) {
+      if (offset + 1 > len) {
+        break;
+      }
+      arrivalTimeUs += data[offset] * 250;
+      offset += 1;
+    } else if (symbol == RTCP_TRANSPORT_CC_LARGE_DELTA) {
+      if (offset + 2 > len) {
+        break;
+      }
+      arrivalTimeUs += (int16_t)RTCPUtils::readUint16(&data[offset]) * 250;
+      offset += 2;
+    } else {
+      break;
+    }
+
+    RTPSentPacketInfo& packet = mSentPackets[sequenceNumber & (RTP_CC_HISTORY_SIZE - 1)];
+    if (packet.valid && packet.transportSequenceNumber == sequenceNumber) {
+      onPacketFeedback(packet, arrivalTimeUs);
+    }
+  }
+
+  if (symbolCount > 0) {
+    mLossFraction = 0.7 * mLossFraction + 0.3 * ((double)lostCount / symbolCount);
+  }
+
+  updateTargetBitrate(TimeUtils::GetMonotonicTimeUs());
+}
+
+// 送信時刻の近いパケットをグループにまとめて、グループ間の遅延の変化を求めます。
+void RTPCongestionController::onPacketFeedback(const RTPSentPacketInfo& packet, int64_t arrivalTimeUs)
+{
+  updateAckedBitrate(packet.size, arrivalTimeUs);
+
+  if (!mCurrentGroup.valid) {
+    mCurrentGroup.firstSendTimeUs = packet.sendTimeUs;
+    mCurrentGroup.lastSendTimeUs = packet.sendTimeUs;
+    mCurrentGroup.lastArrivalTimeUs = arrivalTimeUs;
+    mCurrentGroup.size = packet.size;
+    mCurrentGroup.valid = true;
+    return;
+  }
+
+  // 順番が入れ替わって届いた古いパケットは使用しません。
+  if (packet.sendTimeUs < mCurrentGroup.firstSendTimeUs) {
+    return;
+  }
+
+  if (packet.sendTimeUs - mCurrentGroup.firstSendTimeUs <= RTP_CC_BURST_TIME_US) {
+    if (packet.sendTimeUs > mCurrentGroup.lastSendTimeUs) {
+      mCurrentGroup.lastSendTimeUs = packet.sendTimeUs;
+    }
+    if (arrivalTimeUs > mCurrentGroup.lastArrivalTimeUs) {
+      mCurrentGroup.lastArrivalTimeUs = arrivalTimeUs;
+    }
+    mCurrentGroup.size += packet.size;
+    return;
+  }
+
+  if (mPreviousGroup.valid) {
+    double sendDeltaMs = (double)(mCurrentGroup.lastSendTimeUs - mPreviousGroup.lastSendTimeUs) / 1000.0;
+    double arrivalDeltaMs = (double)(mCurrentGroup.lastArrivalTimeUs - mPreviousGroup.lastArrivalTimeUs) / 1000.0;
+    updateTrendline(arrivalDeltaMs - sendDeltaMs, mCurrentGroup.lastArrivalTimeUs, sendDeltaMs);
+  }
+
+  mPreviousGroup = mCurrentGroup;
+  mCurrentGroup.firstSendTimeUs = packet.sendTimeUs;
+  mCurrentGroup.lastSendTimeUs = packet.sendTimeUs;
+  mCurrentGroup.lastArrivalTimeUs = arrivalTimeUs;
+  mCurrentGroup.size = packet.size;
+}
+
+// 累積した遅延の変化を平滑化して、直近のグループの遅延の傾きを線形回帰で求めます。
+void RTPCongestionController::updateTrendline(double delayDeltaMs, int64_t arrivalTimeUs, double sendDeltaMs)
+{
+  if (mFirstArrivalTimeUs < 0) {
+    mFirstArrivalTimeUs = arrivalTimeUs;
+  }
+  if (mDeltaCount < 1000) {
+    mDeltaCount++;
+  }
+
+  mAccumulatedDelayMs += delayDeltaMs;
+  mSmoothedDelayMs = RTP_CC_TRENDLINE_SMOOTHING * mSmoothedDelayMs +
+      (1.0 - RTP_CC_TRENDLINE_SMOOTHING) * mAccumulatedDelayMs;
+
+  mDelayHistory.emplace_back((double)(arrivalTimeUs - mFirstArrivalTimeUs) / 1000.0, mSmoothedDelayMs);
+  if (mDelayHistory.size() > RTP_CC_TRENDLINE_WINDOW) {
+    mDelayHistory.pop_front();
+  }
+
+  double trend = mPreviousTrend;
+  if (mDelayHistory.size() == RTP_CC_TRENDLINE_WINDOW) {
+    double meanX = 0;
+    double meanY = 0;
+    for (auto& point : mDelayHistory) {
+      meanX += point.first;
+      meanY += point.second;
+    }
+    meanX /= mDelayHistory.size();
+    meanY /= mDelayHistory.size();
+
+    double numerator = 0;
+    double denominator = 0;
+    for (auto& point : mDelayHistory) {
+      numerator += (point.first - meanX) * (point.second - meanY);
+      denominator += (point.first - meanX) * (point.first - meanX);
+    }
+    if (denominator != 0) {
+      trend = numerator / denominator;
+    }
+  }
+
+  detect(trend, sendDeltaMs, arrivalTimeUs);
+}
+
+void RTPCongestionController::detect(double trend, double sendDeltaMs, int64_t nowUs)
+{
+  if (mDeltaCount < 2) {
+    return;
+  }
+
+  double modifiedTrend = (mDeltaCount < 60 ? mDeltaCount : 60) * trend * RTP_CC_TRENDLINE_GAIN;
+  RTPBandwidthUsage usage = mUsage;
+  if (modifiedTrend > mThreshold) {
+    if (mTimeOverUsingMs < 0) {
+      mTimeOverUsingMs = sendDeltaMs / 2;
+    } else {
+      mTimeOverUsingMs += sendDeltaMs;
+    }
+    mOverUseCounter++;
+    if (mTimeOverUsingMs > RTP_CC_OVERUSE_TIME_MS && mOverUseCounter > 1 && trend >= mPreviousTrend) {
+      mTimeOverUsingMs = 0;
+      mOverUseCounter = 0;
+      usage = RTPBandwidthOverusing;
+    }
+  } else if (modifiedTrend < -mThreshold) {
+    mTimeOverUsingMs = -1;
+    mOverUseCounter = 0;
+    usage = RTPBandwidthUnderusing;
+  } else {
+    mTimeOverUsingMs = -1;
+    mOverUseCounter = 0;
+    usage = RTPBandwidthNormal;
+  }
+
+  if (usage != mUsage) {
+    LOG_DEBUG("Bandwidth usage changed. usage=%d trend=%.2f threshold=%.2f\n", usage, modifiedTrend, mThreshold);
+    mUsage = usage;
+  }
+  mPreviousTrend = trend;
+
+  updateThreshold(modifiedTrend, nowUs);
+}
+
+// 他のフローと帯域を奪い合った時に負けてしまわないように、閾値を遅延の変化に合わせて調整します。
+void RTPCongestionController::updateThreshold(double modifiedTrend, int64_t nowUs)
+{
+  if (mLastThresholdUpdateTimeUs < 0) {
+    mLastThresholdUpdateTimeUs = nowUs;
+  }
+
+  double absTrend = fabs(modifiedTrend);
+  if (absTrend > mThreshold + 15.0) {
+    mLastThresholdUpdateTimeUs = nowUs;
+    return;
+  }
+
+  double k = (absTrend < mThreshold) ? 0.039 : 0.0087;
+  double elapsedMs = (double)(nowUs - mLastThresholdUpdateTimeUs) / 1000.0;
+  if (elapsedMs > 100.0) {
+    elapsedMs = 100.0;
+  }
+  mThreshold += k * (absTrend - mThreshold) * elapsedMs;
+  if (mThreshold < 6.0) {
+    mThreshold = 6.0;
+  } else if (mThreshold > 600.0) {
+    mThreshold = 600.0;
+  }
+  mLastThresholdUpdateTimeUs = nowUs;
+}
+
+void RTPCongestionController::updateAckedBitrate(uint32_t size, int64_t arrivalTimeUs)
+{
+  if (mAckedWindowStartUs < 0) {
+    mAckedWindowStartUs = arrivalTimeUs;
+    mAckedWindowBytes = 0;
+  }
+
+  mAckedWindowBytes += size;
+  int64_t elapsed = arrivalTimeUs - mAckedWindowStartUs;
+  if (elapsed >= RTP_CC_ACKED_WINDOW_US) {
+    double bitrate = (double)mAckedWindowBytes * 8.0 * 1000000.0 / elapsed;
+    mAckedBitrate = (mAckedBitrate == 0) ? bitrate : 0.7 * mAckedBitrate + 0.3 * bitrate;
+    mAckedWindowStartUs = arrivalTimeUs;
+    mAckedWindowBytes = 0;
+  }
+}
+
+// AIMD で推定ビットレートを更新します。
+// 過負荷の場合には受信されたビットレートまで下げ、問題が無い場合には少しずつ上げていきます。
+void RTPCongestionController::updateTargetBitrate(uint64_t nowUs)
+{
+  if (mLastUpdateTimeUs == 0) {
+    mLastUpdateTimeUs = nowUs;
+  }
+  double elapsed = (double)(nowUs - mLastUpdateTimeUs) / 1000000.0;
+  if (elapsed > 1.0) {
+    elapsed = 1.0;
+  }
+  mLastUpdateTimeUs = nowUs;
+
+  double target = mTargetBitrate;
+  bool canDecrease = (nowUs - mLastDecreaseTimeUs >= RTP_CC_DECREASE_INTERVAL_US);
+  if (mUsage == RTPBandwidthOverusing) {
+    if (canDecrease) {
+      double base = (mAckedBitrate > 0) ? mAckedBitrate : target;
+      if (base * RTP_CC_DECREASE_FACTOR < target) {
+        target = base * RTP_CC_DECREASE_FACTOR;
+      }
+      mLastDecreaseTimeUs = nowUs;
+    }
+  } else if (mLossFraction > RTP_CC_LOSS_THRESHOLD) {
+    if (canDecrease) {
+      target *= (1.0 - 0.5 * mLossFraction);
+      mLastDecreaseTimeUs = nowUs;
+    }
+  } else if (mUsage == RTPBandwidthNormal) {
+    target *= pow(RTP_CC_INCREASE_FACTOR, elapsed);
+  }
+
+  if (target < mMinBitrate) {
+    target = mMinBitrate;
+  } else if (target > mMaxBitrate) {
+    target = mMaxBitrate;
+  }
+  mTargetBitrate = (uint32_t)target;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+// 送信時刻を保持するパケット数 (2 のべき乗)
+#define RTP_CC_HISTORY_SIZE 4096
+
+// transport-wide-cc のシーケンス番号ごとに保持する送信情報
+class RTPSentPacketInfo {
+public:
+  uint16_t transportSequenceNumber = 0;
+  uint32_t size = 0;
+  uint64_t sendTimeUs = 0;
+  bool valid = false;
+};
+
+// 送信時刻の近いパケットをまとめたグループ
+class RTPPacketGroup {
+public:
+  uint64_t firstSendTimeUs = 0;
+  uint64_t lastSendTimeUs = 0;
+  int64_t lastArrivalTimeUs = 0;
+  uint32_t size = 0;
+  bool valid = false;
+};
+
+// 輻輳の状態
+typedef enum {
+  RTPBandwidthNormal,
+  RTPBandwidthOverusing,
+  RTPBandwidthUnderusing
+} RTPBandwidthUsage;
+
+// transport-cc のフィードバックから送信先までの経路の帯域を推定します。
+//
+// 送信したパケットの送信時刻と、フィードバックに含まれる到着時刻の差分の変化 (遅延勾配) を
+// 線形回帰で求め、キューイング遅延が増え続けている場合には帯域を超えていると判断します。
+// 推定ビットレートは AIMD で更新します。
+//
+// パケットの送信はメディアの送信スレッドとペーサーのスレッドから、フィードバックの処理は
+// RTCP の受信スレッドから行われます。
+class RTPCongestionController {
+private:
+  std::mutex mMutex;
+  std::vector<RTPSentPacketInfo> mSentPackets;
+  // フィードバックを展開するバッファ
+  std::vector<uint8_t> mSymbols;
+  uint32_t mMinBitrate;
+  uint32_t mMaxBitrate;
+  std::atomic<uint32_t> mTargetBitrate;
+
+  // 遅延勾配の推定 (trendline)
+  RTPPacketGroup mCurrentGroup;
+  RTPPacketGroup mPreviousGroup;
+  double mAccumulatedDelayMs;
+  double mSmoothedDelayMs;
+  int64_t mFirstArrivalTimeUs;
+  std::deque<std::pair<double, double>> mDelayHistory;
+  uint32_t mDeltaCount;
+  double mPreviousTrend;
+
+  // 過負荷の検出
+  double mThreshold;
+  double mTimeOverUsingMs;
+  int mOverUseCounter;
+  int64_t mLastThresholdUpdateTimeUs;
+  RTPBandwidthUsage mUsage;
+
+  // 受信されたビットレートの計測
+  int64_t mAckedWindowStartUs;
+  uint64_t mAckedWindowBytes;
+  double mAckedBitrate;
+
+  // パケットロス率 (EWMA)
+  double mLossFraction;
+
+  // AIMD
+  uint64_t mLastUpdateTimeUs;
+  uint64_t mLastDecreaseTimeUs;
+
+  void onPacketFeedback(const RTPSentPacketInfo& packet, int64_t arrivalTimeUs);
+  void updateTrendline(double delayDeltaMs, int64_t arrivalTimeUs, double sendDeltaMs);
+  void detect(double trend, double sendDeltaMs, int64_t nowUs);
+  void updateThreshold(double modifiedTrend, int64_t nowUs);
+  void updateAckedBitrate(uint32_t size, int64_t arrivalTimeUs);
+  void updateTargetBitrate(uint64_t nowUs);
+
+public:
+  RTPCongestionController();
+  virtual ~RTPCongestionController();
+
+  // 推定ビットレートの範囲 (bps) を設定します。推定ビットレートの初期値は maxBitrate です。
+  void setBitrateRange(uint32_t minBitrate, uint32_t maxBitrate);
+  void reset();
+
+  // パケットを送信した時に呼び出します。
+  void onPacketSent(uint16_t transportSequenceNumber, uint32_t size, uint64_t sendTimeUs);
+  // transport-cc のフィードバック (RTPFB FMT=15) を受信した時に呼び出します。
+  void onTransportFeedback(const uint8_t *data, uint32_t len);
+
+  // 推定ビットレート (bps)
+  uint32_t getTargetBitrate() {
+    return mTargetBitrate;
+  }
+};
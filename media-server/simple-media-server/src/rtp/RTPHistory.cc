@@ -0,0 +1,133 @@
+#include "RTPHistory.h"
+#include "../utils/TimeUtils.h"
+#include <string.h>
+
+// 同じパケットを再送する最小間隔
+// mediasoup は RTT に合わせて NACK を繰り返し送信してくるので、短い間隔での重複だけを防ぎます。
+#define RTP_HISTORY_MIN_RETRANSMIT_INTERVAL_MS 10
+// レート制限のトークンバケットに溜めることができる量 (最大ビットレートでの時間)
+#define RTP_HISTORY_BURST_MS 100
+
+RTPHistory::RTPHistory()
+{
+  mEnabled = false;
+  mMaxAgeMs = 1000;
+  mMinRetransmitIntervalMs = RTP_HISTORY_MIN_RETRANSMIT_INTERVAL_MS;
+  mMaxBitrate = 2000000;
+  mTokens = 0;
+  mLastRefillTimeUs = 0;
+}
+
+RTPHistory::~RTPHistory()
+{
+}
+
+void RTPHistory::setEnabled(bool enabled)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  mEnabled = enabled;
+  if (mEnabled && mPackets.empty()) {
+    mPackets.resize(RTP_HISTORY_SIZE);
+  } else if (!mEnabled) {
+    mPackets.clear();
+    mPackets.shrink_to_fit();
+  }
+}
+
+void RTPHistory::setMaxAge(uint32_t maxAgeMs)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  mMaxAgeMs = maxAgeMs;
+}
+
+void RTPHistory::setMaxBitrate(uint32_t bitrate)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  mMaxBitrate = bitrate;
+}
+
+void RTPHistory::add(uint16_t sequenceNumber, const uint8_t *header, uint32_t headerLen, const struct iovec *payload, int payloadCount)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  if (!mEnabled) {
+    return;
+  }
+
+  RTPHistoryPacket& packet = mPackets[sequenceNumber & (RTP_HISTORY_SIZE - 1)];
+  packet.valid = false;
+
+  uint32_t length = headerLen;
+  if (length > RTP_MAX_PACKET_SIZE) {
+    return;
+  }
+  memcpy(packet.data, header, headerLen);
+  for (int i = 0; i < payloadCount; i++) {
+    if (length + payload[i].iov_len > RTP_MAX_PACKET_SIZE) {
+      return;
+    }
+    memcpy(&packet.data[length], payload[i].iov_base, payload[i].iov_len);
+    length += payload[i].iov_len;
+  }
+
+  packet.length = length;
+  packet.sequenceNumber = sequenceNumber;
+  packet.sendTimeUs = TimeUtils::GetMonotonicTimeUs();
+  packet.lastRetransmitTimeUs = 0;
+  packet.valid = true;
+}
+
+void RTPHistory::refill(uint64_t nowUs)
+{
+  double capacity = mMaxBitrate / 8.0 * RTP_HISTORY_BURST_MS / 1000.0;
+  if (mLastRefillTimeUs == 0) {
+    mTokens = capacity;
+  } else {
+    mTokens += mMaxBitrate / 8.0 * (nowUs - mLastRefillTimeUs) / 1000000.0;
+    if (mTokens > capacity) {
+      mTokens = capacity;
+    }
+  }
+  mLastRefillTimeUs = nowUs;
+}
+
+RTPHistory::Result RTPHistory::get(uint16_t sequenceNumber, uint8_t *out, uint32_t *outLen)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  if (!mEnabled) {
+    return NotFound;
+  }
+
+  RTPHistoryPacket& packet = mPackets[sequenceNumber & (RTP_HISTORY_SIZE - 1)];
+  if (!packet.valid || packet.sequenceNumber != sequenceNumber) {
+    return NotFound;
+  }
+
+  uint64_t now = TimeUtils::GetMonotonicTimeUs();
+  if (now - packet.sendTimeUs > (uint64_t)mMaxAgeMs * 1000) {
+    return TooOld;
+  }
+
+  if (packet.lastRetransmitTimeUs != 0 &&
+      now - packet.lastRetransmitTimeUs < (uint64_t)mMinRetransmitIntervalMs * 1000) {
+    return TooSoon;
+  }
+
+  refill(now);
+  if (mTokens < packet.length) {
+    return RateLimited;
+  }
+  mTokens -= packet.length;
+
+  packet.lastRetransmitTimeUs = now;
+  memcpy(out, packet.data, packet.length);
+  *outLen = packet.length;
+  return Retransmit;
+}
+
+void RTPHistory::clear()
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  for (auto& packet : mPackets) {
+    packet.valid = false;
+  }
+}
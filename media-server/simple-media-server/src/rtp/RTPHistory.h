@@ -0,0 +1,70 @@
+#pragma once
+
+#include <sys/uio.h>
+#include <stdint.h>
+#include <mutex>
+#include <vector>
+
+#include "RTPPacket.h"
+
+// 保持する RTP パケット数 (2 のべき乗)
+#define RTP_HISTORY_SIZE 1024
+
+// 再送用に保持している RTP パケット
+class RTPHistoryPacket {
+public:
+  uint8_t data[RTP_MAX_PACKET_SIZE];
+  uint32_t length = 0;
+  uint16_t sequenceNumber = 0;
+  uint64_t sendTimeUs = 0;
+  uint64_t lastRetransmitTimeUs = 0;
+  bool valid = false;
+};
+
+// NACK で再送するために、送信した RTP パケットをシーケンス番号ごとに保持するリングバッファです。
+//
+// RTP パケットの追加は送信スレッドから、再送するパケットの取得は RTCP の受信スレッドから行われます。
+class RTPHistory {
+private:
+  std::mutex mMutex;
+  std::vector<RTPHistoryPacket> mPackets;
+  bool mEnabled;
+  uint32_t mMaxAgeMs;
+  uint32_t mMinRetransmitIntervalMs;
+
+  // 再送のレート制限 (トークンバケット)
+  uint32_t mMaxBitrate;
+  double mTokens;
+  uint64_t mLastRefillTimeUs;
+
+  void refill(uint64_t nowUs);
+
+public:
+  RTPHistory();
+  virtual ~RTPHistory();
+
+  void setEnabled(bool enabled);
+  bool isEnabled() {
+    return mEnabled;
+  }
+  // この時間より古いパケットは再送しません。
+  void setMaxAge(uint32_t maxAgeMs);
+  // 再送に使用する最大ビットレート (bps)
+  void setMaxBitrate(uint32_t bitrate);
+
+  // RTP ヘッダーと payload をコピーして保持します。
+  void add(uint16_t sequenceNumber, const uint8_t *header, uint32_t headerLen, const struct iovec *payload, int payloadCount);
+
+  // 再送するパケットの結果
+  typedef enum {
+    Retransmit,
+    NotFound,
+    TooOld,
+    TooSoon,
+    RateLimited
+  } Result;
+
+  // sequenceNumber のパケットを再送できる場合には、out にコピーして Retransmit を返します。
+  Result get(uint16_t sequenceNumber, uint8_t *out, uint32_t *outLen);
+  void clear();
+};
@@ -0,0 +1,378 @@
+#include "RTPPacer.h"
+#include "../utils/Log.h"
+#include "../utils/TimeUtils.h"
+#include <string.h>
+#include <thread>
+
+// ペーサーのキューを確認する間隔
+#define RTP_PACER_INTERVAL_US 1000
+// トークンバケットに溜めることができる量 (ペーシングレートでの時間)
+#define RTP_PACER_BURST_MS 5
+// ビットレートを計測する間隔
+#define RTP_PACER_MEASURE_WINDOW_US 500000
+// 統計情報をログに出力する間隔
+#define RTP_PACER_REPORT_INTERVAL_US 10000000
+// 再利用のために保持しておくパケット数の上限
+#define RTP_PACER_MAX_FREE_PACKETS 512
+
+RTPPacer::RTPPacer()
+{
+  mSSRC = 0;
+  mAbsSendTimeOffset = 0;
+  mCongestionController = nullptr;
+  mTransportSequenceNumberOffset = 0;
+  mMultiplier = 2.5;
+  mMinBitrate = 500000;
+  mMaxDelayMs = 5;
+  mQueuedBytes = 0;
+  mTokens = 0;
+  mPacingRate = mMinBitrate / 8.0;
+  mLastRefillTimeUs = 0;
+  mWindowStartTimeUs = 0;
+  mWindowBytes = 0;
+  mMeasuredBitrate = 0;
+  mDelaySumUs = 0;
+  mDelayCount = 0;
+  mMaxDelayUs = 0;
+  mLastReportTimeUs = 0;
+}
+
+RTPPacer::~RTPPacer()
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  for (auto packet : mQueue) {
+    delete packet;
+  }
+  mQueue.clear();
+  for (auto packet : mSendingPackets) {
+    delete packet;
+  }
+  mSendingPackets.clear();
+  for (auto packet : mFreePackets) {
+    delete packet;
+  }
+  mFreePackets.clear();
+}
+
+void RTPPacer::setSSRC(uint32_t ssrc)
+{
+  mSSRC = ssrc;
+}
+
+void RTPPacer::setMultiplier(double multiplier)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  mMultiplier = multiplier;
+}
+
+void RTPPacer::setMinBitrate(uint32_t bitrate)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  mMinBitrate = bitrate;
+}
+
+void RTPPacer::setMaxDelay(uint32_t delayMs)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  mMaxDelayMs = delayMs;
+}
+
+void RTPPacer::setAbsSendTimeOffset(uint32_t offset)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  mAbsSendTimeOffset = offset;
+}
+
+void RTPPacer::setCongestionController(RTPCongestionController *controller, uint32_t transportSequenceNumberOffset)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  mCongestionController = controller;
+  mTransportSequenceNumberOffset = transportSequenceNumberOffset;
+}
+
+void RTPPacer::refill(uint64_t nowUs, double rate)
+{
+  if (mLastRefillTimeUs == 0) {
+    mLastRefillTimeUs = nowUs;
+    mTokens = rate * RTP_PACER_BURST_MS / 1000.0;
+    return;
+  }
+
+  double elapsed = (nowUs - mLastRefillTimeUs) / 1000000.0;
+  mLastRefillTimeUs = nowUs;
+
+  double capacity = rate * RTP_PACER_BURST_MS / 1000.0;
+  if (capacity < 2 * RTP_MAX_PACKET_SIZE) {
+    capacity = 2 * RTP_MAX_PACKET_SIZE;
+  }
+
+  mTokens += rate * elapsed;
+  if (mTokens > capacity) {
+    mTokens = capacity;
+  }
+}
+
+void RTPPacer::measure(uint32_t size, uint64_t nowUs)
+{
+  if (mWindowStartTimeUs == 0) {
+    mWindowStartTimeUs = nowUs;
+  }
+
+  mWindowBytes += size;
+
+  uint64_t elapsed = nowUs - mWindowStartTimeUs;
+  if (elapsed >= RTP_PACER_MEASURE_WINDOW_US) {
+    double bitrate = mWindowBytes * 8.0 * 1000000.0 / elapsed;
+    if (mMeasuredBitrate == 0) {
+      mMeasuredBitrate = bitrate;
+    } else {
+      mMeasuredBitrate = 0.8 * mMeasuredBitrate + 0.2 * bitrate;
+    }
+    mWindowStartTimeUs = nowUs;
+    mWindowBytes = 0;
+
+    double rate = mMeasuredBitrate * mMultiplier;
+    if (rate < mMinBitrate) {
+      rate = mMinBitrate;
+    }
+    mPacingRate = rate / 8.0;
+  }
+}
+
+bool RTPPacer::trySend(uint32_t size)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  uint64_t now = TimeUtils::GetMonotonicTimeUs();
+  measure(size, now);
+
+  // 先に送信待ちのパケットがある場合には、順番が入れ替わらないようにキューに入れます。
+  if (!mQueue.empty()) {
+    return false;
+  }
+
+  refill(now, mPacingRate);
+  if (mTokens < size) {
+    return false;
+  }
+  mTokens -= size;
+  return true;
+}
+
+void RTPPacer::enqueue(const struct sockaddr_in *dest, const struct iovec *iov, int iovCount)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+
+  RTPPacedPacket *packet = nullptr;
+  if (mFreePackets.empty()) {
+    packet = new RTPPacedPacket();
+  } else {
+    packet = mFreePackets.back();
+    mFreePackets.pop_back();
+  }
+
+  uint32_t length = 0;
+  for (int i = 0; i < iovCount; i++) {
+    if (length + iov[i].iov_len > RTP_MAX_PACKET_SIZE) {
+      LOG_ERROR("RTP packet is too large to be paced.\n");
+      mFreePackets.push_back(packet);
+      return;
+    }
+    memcpy(&packet->data[length], iov[i].iov_base, iov[i].iov_len);
+    length += iov[i].iov_len;
+  }
+  packet->length = length;
+  packet->dest = *dest;
+  packet->enqueueTimeUs = TimeUtils::GetMonotonicTimeUs();
+
+  mQueue.push_back(packet);
+  mQueuedBytes += length;
+}
+
+// キューのパケットを送信するレート (バイト/秒) を返却します。
+// ペーシングレートのままでは先頭のパケットが最大遅延までに送信しきれない場合には、
+// 残りの時間でキューを均等に送信できるレートまで上げます。
+double RTPPacer::getDrainRate(uint64_t nowUs)
+{
+  if (mQueue.empty()) {
+    return mPacingRate;
+  }
+
+  uint64_t deadline = mQueue.front()->enqueueTimeUs + (uint64_t)mMaxDelayMs * 1000;
+  uint64_t remaining = deadline > nowUs ? deadline - nowUs : 0;
+  if (remaining < RTP_PACER_INTERVAL_US) {
+    remaining = RTP_PACER_INTERVAL_US;
+  }
+
+  double rate = mQueuedBytes * 1000000.0 / remaining;
+  return rate > mPacingRate ? rate : mPacingRate;
+}
+
+void RTPPacer::drain(RTPBatch& batch)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  uint64_t now = TimeUtils::GetMonotonicTimeUs();
+  refill(now, getDrainRate(now));
+
+  while (!mQueue.empty()) {
+    RTPPacedPacket *packet = mQueue.front();
+    uint64_t delay = now - packet->enqueueTimeUs;
+
+    // 遅延が大きくなりすぎないように、最大遅延を超えたパケットはトークンが無くても送信します。
+    if (mTokens < packet->length && delay < (uint64_t)mMaxDelayMs * 1000) {
+      break;
+    }
+
+    mQueue.pop_front();
+    mQueuedBytes -= packet->length;
+    mTokens -= packet->length;
+    // トークンが無いのに送信した分を借りとして残すと、後続のフレームまで最大遅延まで待たされるので、0 で止めます。
+    if (mTokens < 0) {
+      mTokens = 0;
+    }
+
+    mDelaySumUs += delay;
+    mDelayCount++;
+    if (delay > mMaxDelayUs) {
+      mMaxDelayUs = delay;
+    }
+
+    // キューで待っていた分だけ送信時刻がずれるので、実際に送信する時刻に書き換えます。
+    if (mAbsSendTimeOffset != 0 && mAbsSendTimeOffset + 3 <= packet->length) {
+      RTPHeader::writeAbsSendTime(&packet->data[mAbsSendTimeOffset], RTPHeader::toAbsSendTime(now));
+    }
+    if (mCongestionController && mTransportSequenceNumberOffset != 0 &&
+        mTransportSequenceNumberOffset + 2 <= packet->length) {
+      uint16_t transportSequenceNumber = ((uint16_t)packet->data[mTransportSequenceNumberOffset] << 8) |
+          packet->data[mTransportSequenceNumberOffset + 1];
+      mCongestionController->onPacketSent(transportSequenceNumber, packet->length, now);
+    }
+
+    struct iovec iov;
+    iov.iov_base = packet->data;
+    iov.iov_len = packet->length;
+    batch.add(&packet->dest, &iov, 1, 0);
+    mSendingPackets.push_back(packet);
+  }
+
+  report(now);
+}
+
+void RTPPacer::release()
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  for (auto packet : mSendingPackets) {
+    if (mFreePackets.size() < RTP_PACER_MAX_FREE_PACKETS) {
+      mFreePackets.push_back(packet);
+    } else {
+      delete packet;
+    }
+  }
+  mSendingPackets.clear();
+}
+
+void RTPPacer::report(uint64_t nowUs)
+{
+  if (mLastReportTimeUs == 0) {
+    mLastReportTimeUs = nowUs;
+    return;
+  }
+
+  if (nowUs - mLastReportTimeUs < RTP_PACER_REPORT_INTERVAL_US) {
+    return;
+  }
+  mLastReportTimeUs = nowUs;
+
+  if (mDelayCount > 0) {
+    LOG_INFO("RTPPacer ssrc=%u bitrate=%.0fkbps pacingRate=%.0fkbps paced=%lu queueDelay(avg=%.1fms max=%.1fms)\n",
+        mSSRC, mMeasuredBitrate / 1000.0, mPacingRate * 8.0 / 1000.0, (unsigned long)mDelayCount,
+        mDelaySumUs / 1000.0 / mDelayCount, mMaxDelayUs / 1000.0);
+  }
+
+  mDelaySumUs = 0;
+  mDelayCount = 0;
+  mMaxDelayUs = 0;
+}
+
+uint32_t RTPPacer::getQueueDelayMs()
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  if (mQueue.empty()) {
+    return 0;
+  }
+  return (TimeUtils::GetMonotonicTimeUs() - mQueue.front()->enqueueTimeUs) / 1000;
+}
+
+uint32_t RTPPacer::getQueueSize()
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mQueue.size();
+}
+
+
+RTPPacerThread::RTPPacerThread()
+{
+  mRunning = false;
+}
+
+RTPPacerThread::~RTPPacerThread()
+{
+  stop();
+}
+
+void RTPPacerThread::start(int sockfd)
+{
+  mBatch.setSocket(sockfd);
+  mRunning = true;
+  startThread();
+  if (isStopped()) {
+    mRunning = false;
+  }
+}
+
+void RTPPacerThread::stop()
+{
+  stopThread();
+
+  while (mRunning) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  std::lock_guard<std::mutex> lock(mMutex);
+  mPacers.clear();
+  mBatch.setSocket(-1);
+}
+
+void RTPPacerThread::addPacer(RTPPacer *pacer)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  mPacers.push_back(pacer);
+}
+
+void RTPPacerThread::removePacer(RTPPacer *pacer)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  for (auto it = mPacers.begin(); it != mPacers.end(); ++it) {
+    if (*it == pacer) {
+      mPacers.erase(it);
+      break;
+    }
+  }
+}
+
+void RTPPacerThread::runThread()
+{
+  while (!isStopped()) {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      for (auto pacer : mPacers) {
+        pacer->drain(mBatch);
+      }
+      mBatch.flush();
+      for (auto pacer : mPacers) {
+        pacer->release();
+      }
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(RTP_PACER_INTERVAL_US));
+  }
+  mRunning = false;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "RTPBatch.h"
+#include "RTPCongestionController.h"
+#include "RTPPacket.h"
+#include "../utils/BaseThread.h"
+
+// ペーサーのキューに入れられた RTP パケット
+// 送信するまで元のバッファが残っているとは限らないので、パケットをコピーして保持します。
+class RTPPacedPacket {
+public:
+  uint8_t data[RTP_MAX_PACKET_SIZE];
+  uint32_t length;
+  struct sockaddr_in dest;
+  uint64_t enqueueTimeUs;
+};
+
+// ストリームごとのトークンバケット方式のペーサーです。
+//
+// 送信レートは、計測したビットレートに multiplier を掛けた値になります。
+// トークンが足りている間はパケットをそのまま送信し、足りない場合にはキューに入れて、
+// RTPPacerThread がトークンが溜まるのに合わせて少しずつ送信します。
+// キーフレームのような大きなフレームが一度に送信されてしまうのを防ぎます。
+// キューのパケットが最大遅延までに送信しきれない場合には、送信レートを上げて最大遅延の間に均等に送信します。
+class RTPPacer {
+private:
+  std::mutex mMutex;
+  uint32_t mSSRC;
+  // abs-send-time を書き込む位置 (0 の場合には書き込みません)
+  uint32_t mAbsSendTimeOffset;
+  // 送信時刻を通知する輻輳制御と、transport-wide-cc のシーケンス番号の位置
+  RTPCongestionController *mCongestionController;
+  uint32_t mTransportSequenceNumberOffset;
+  double mMultiplier;
+  uint32_t mMinBitrate;
+  uint32_t mMaxDelayMs;
+
+  // トークンバケット (単位はバイト)
+  double mTokens;
+  double mPacingRate;
+  uint64_t mLastRefillTimeUs;
+
+  // ビットレートの計測
+  uint64_t mWindowStartTimeUs;
+  uint64_t mWindowBytes;
+  double mMeasuredBitrate;
+
+  std::deque<RTPPacedPacket *> mQueue;
+  // キューに入っているパケットの合計サイズ
+  uint64_t mQueuedBytes;
+  std::vector<RTPPacedPacket *> mSendingPackets;
+  std::vector<RTPPacedPacket *> mFreePackets;
+
+  // キューイング遅延の統計
+  uint64_t mDelaySumUs;
+  uint64_t mDelayCount;
+  uint64_t mMaxDelayUs;
+  uint64_t mLastReportTimeUs;
+
+  void refill(uint64_t nowUs, double rate);
+  double getDrainRate(uint64_t nowUs);
+  void measure(uint32_t size, uint64_t nowUs);
+  void report(uint64_t nowUs);
+
+public:
+  RTPPacer();
+  virtual ~RTPPacer();
+
+  void setSSRC(uint32_t ssrc);
+  // 計測したビットレートに対するペーシングレートの倍率
+  void setMultiplier(double multiplier);
+  // ペーシングレートの下限 (bps)
+  void setMinBitrate(uint32_t bitrate);
+  // キューに入れてから送信するまでの最大の遅延時間
+  void setMaxDelay(uint32_t delayMs);
+  // キューから送信する時に abs-send-time を書き換える位置を設定します。
+  void setAbsSendTimeOffset(uint32_t offset);
+  // キューから送信したパケットの送信時刻を controller に通知します。
+  void setCongestionController(RTPCongestionController *controller, uint32_t transportSequenceNumberOffset);
+
+  // すぐに送信できる場合には、トークンを消費して true を返却します。
+  // false の場合には enqueue でキューに入れてください。
+  bool trySend(uint32_t size);
+  void enqueue(const struct sockaddr_in *dest, const struct iovec *iov, int iovCount);
+
+  // 送信できるパケットを batch に追加します。
+  // batch を送信した後に release を呼び出して、パケットを返却してください。
+  void drain(RTPBatch& batch);
+  void release();
+
+  // 現在キューにあるパケットの遅延時間
+  uint32_t getQueueDelayMs();
+  uint32_t getQueueSize();
+};
+
+
+// RTPSocket ごとに 1 つ作成され、登録されている RTPPacer のキューを定期的に送信します。
+// 同じタイミングで送信できる複数のストリームのパケットは、1 回の sendmmsg でまとめて送信します。
+class RTPPacerThread : public BaseThread {
+private:
+  std::mutex mMutex;
+  std::vector<RTPPacer *> mPacers;
+  RTPBatch mBatch;
+  std::atomic<bool> mRunning;
+
+protected:
+  virtual void runThread() override;
+
+public:
+  RTPPacerThread();
+  virtual ~RTPPacerThread();
+
+  void start(int sockfd);
+  void stop();
+
+  void addPacer(RTPPacer *pacer);
+  void removePacer(RTPPacer *pacer);
+};
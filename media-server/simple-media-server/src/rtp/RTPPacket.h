@@ -0,0 +1,269 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+// see https://tex2e.github.io/rfc-translater/html/rfc3550.html
+
+#define RTP_VERSION 2
+#define RTP_HEADER_LEN 12
+
+// jrtplib の RTP_DEFAULTPACKETSIZE と同じ値にしておきます。
+#define RTP_DEFAULT_PACKET_SIZE 1400
+
+#define MAXLEN (RTP_DEFAULT_PACKET_SIZE - 100 - RTP_HEADER_LEN)
+
+// 送信する RTP パケットの最大サイズ (MTU)
+#define RTP_MAX_PACKET_SIZE 1500
+
+// RTP Header
+// 0                   1                   2                   3
+// 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |V=2|P|X|  CC   |M|     PT      |       sequence number         |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |                           timestamp                           |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |           synchronization source (SSRC) identifier            |
+// +=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+
+
+// RTP Header Extension (One-Byte Header)
+// see https://tex2e.github.io/rfc-translater/html/rfc8285.html
+// 0                   1                   2                   3
+// 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |       0xBE    |    0xDE       |           length=3            |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |  ID   | L=0   |     data      |  ID   |  L=1  |   data...
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+
+// 拡張ヘッダーを含めた RTP ヘッダーの最大長
+#define RTP_MAX_HEADER_LEN 48
+// One-Byte Header で指定できるデータの最大長
+#define RTP_EXTENSION_MAX_DATA_LEN 16
+
+// mediasoup の supportedRtpCapabilities に合わせた拡張ヘッダーの ID
+#define RTP_EXTENSION_ID_MID 1
+#define RTP_EXTENSION_ID_ABS_SEND_TIME 4
+#define RTP_EXTENSION_ID_TRANSPORT_WIDE_CC 5
+#define RTP_EXTENSION_ID_FRAME_MARKING 7
+
+#define RTP_EXTENSION_URI_MID "urn:ietf:params:rtp-hdrext:sdes:mid"
+#define RTP_EXTENSION_URI_ABS_SEND_TIME "http://www.webrtc.org/experiments/rtp-hdrext/abs-send-time"
+#define RTP_EXTENSION_URI_TRANSPORT_WIDE_CC "http://www.ietf.org/id/draft-holmer-rmcat-transport-wide-cc-extensions-01"
+#define RTP_EXTENSION_URI_FRAME_MARKING "urn:ietf:params:rtp-hdrext:framemarking"
+
+// Frame Marking (Long Form)
+// see https://datatracker.ietf.org/doc/html/draft-ietf-avtext-framemarking-07
+//  0                   1                   2                   3
+//  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |  ID=? |  L=2  |S|E|I|D|B| TID |      LID      |   TL0PICIDX   |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+#define RTP_FRAME_MARKING_START 0x80
+#define RTP_FRAME_MARKING_END 0x40
+#define RTP_FRAME_MARKING_INDEPENDENT 0x20
+#define RTP_FRAME_MARKING_DISCARDABLE 0x10
+#define RTP_FRAME_MARKING_BASE_LAYER_SYNC 0x08
+
+// SSRC ごとに固定の部分を事前に作成しておき、送信時には可変部分だけを書き換えます。
+// 拡張ヘッダーも事前に領域を確保しておき、送信時には値だけを書き込みます。
+class RTPHeader {
+private:
+  uint8_t mTemplate[RTP_MAX_HEADER_LEN];
+  uint32_t mSize;
+  uint8_t mPayloadType;
+  uint32_t mSSRC;
+
+  // 拡張ヘッダー
+  std::string mMid;
+  uint8_t mMidId;
+  uint8_t mAbsSendTimeId;
+  uint8_t mTransportSequenceNumberId;
+  uint8_t mFrameMarkingId;
+  // 値を書き込む位置 (0 の場合には拡張ヘッダーがありません)
+  uint32_t mAbsSendTimeOffset;
+  uint32_t mTransportSequenceNumberOffset;
+  uint32_t mFrameMarkingOffset;
+
+  void build() {
+    mTemplate[0] = (RTP_VERSION << 6);
+    mTemplate[1] = (mPayloadType & 0x7F);
+    mTemplate[2] = 0;
+    mTemplate[3] = 0;
+    mTemplate[4] = 0;
+    mTemplate[5] = 0;
+    mTemplate[6] = 0;
+    mTemplate[7] = 0;
+    mTemplate[8] = (mSSRC >> 24) & 0xFF;
+    mTemplate[9] = (mSSRC >> 16) & 0xFF;
+    mTemplate[10] = (mSSRC >> 8) & 0xFF;
+    mTemplate[11] = mSSRC & 0xFF;
+    mSize = RTP_HEADER_LEN;
+    mAbsSendTimeOffset = 0;
+    mTransportSequenceNumberOffset = 0;
+    mFrameMarkingOffset = 0;
+
+    if (mMidId == 0 && mAbsSendTimeId == 0 && mTransportSequenceNumberId == 0 && mFrameMarkingId == 0) {
+      return;
+    }
+
+    mTemplate[0] |= 0x10;
+    uint32_t extStart = mSize;
+    mTemplate[mSize++] = 0xBE;
+    mTemplate[mSize++] = 0xDE;
+    mTemplate[mSize++] = 0;
+    mTemplate[mSize++] = 0;
+
+    if (mMidId != 0 && !mMid.empty()) {
+      mTemplate[mSize++] = (mMidId << 4) | ((mMid.size() - 1) & 0x0F);
+      memcpy(&mTemplate[mSize], mMid.data(), mMid.size());
+      mSize += mMid.size();
+    }
+    if (mAbsSendTimeId != 0) {
+      mTemplate[mSize++] = (mAbsSendTimeId << 4) | 2;
+      mAbsSendTimeOffset = mSize;
+      mTemplate[mSize++] = 0;
+      mTemplate[mSize++] = 0;
+      mTemplate[mSize++] = 0;
+    }
+    if (mTransportSequenceNumberId != 0) {
+      mTemplate[mSize++] = (mTransportSequenceNumberId << 4) | 1;
+      mTransportSequenceNumberOffset = mSize;
+      mTemplate[mSize++] = 0;
+      mTemplate[mSize++] = 0;
+    }
+    if (mFrameMarkingId != 0) {
+      mTemplate[mSize++] = (mFrameMarkingId << 4) | 2;
+      mFrameMarkingOffset = mSize;
+      mTemplate[mSize++] = 0;
+      mTemplate[mSize++] = 0;
+      mTemplate[mSize++] = 0;
+    }
+
+    // 4 バイト境界までパディングします。
+    while ((mSize - extStart) % 4 != 0) {
+      mTemplate[mSize++] = 0;
+    }
+    uint16_t words = (mSize - extStart - 4) / 4;
+    mTemplate[extStart + 2] = (words >> 8) & 0xFF;
+    mTemplate[extStart + 3] = words & 0xFF;
+  }
+
+public:
+  RTPHeader() {
+    memset(mTemplate, 0, sizeof(mTemplate));
+    mSize = RTP_HEADER_LEN;
+    mPayloadType = 0;
+    mSSRC = 0;
+    mMidId = 0;
+    mAbsSendTimeId = 0;
+    mTransportSequenceNumberId = 0;
+    mFrameMarkingId = 0;
+    mAbsSendTimeOffset = 0;
+    mTransportSequenceNumberOffset = 0;
+    mFrameMarkingOffset = 0;
+  }
+
+  void init(uint8_t payloadType, uint32_t ssrc) {
+    mPayloadType = payloadType;
+    mSSRC = ssrc;
+    build();
+  }
+
+  // 拡張ヘッダーを設定します。id に 0 を指定した場合には、その拡張ヘッダーは付加しません。
+  void setExtensions(uint8_t midId, const std::string& mid, uint8_t absSendTimeId, uint8_t transportSequenceNumberId) {
+    mMidId = midId;
+    mMid = mid.substr(0, RTP_EXTENSION_MAX_DATA_LEN);
+    mAbsSendTimeId = absSendTimeId;
+    mTransportSequenceNumberId = transportSequenceNumberId;
+    build();
+  }
+
+  // frame-marking の拡張ヘッダーを設定します。0 を指定した場合には付加しません。
+  void setFrameMarkingExtension(uint8_t frameMarkingId) {
+    mFrameMarkingId = frameMarkingId;
+    build();
+  }
+
+  bool hasAbsSendTime() const {
+    return mAbsSendTimeOffset != 0;
+  }
+
+  bool hasTransportSequenceNumber() const {
+    return mTransportSequenceNumberOffset != 0;
+  }
+
+  bool hasFrameMarking() const {
+    return mFrameMarkingOffset != 0;
+  }
+
+  uint32_t getFrameMarkingOffset() const {
+    return mFrameMarkingOffset;
+  }
+
+  uint32_t getAbsSendTimeOffset() const {
+    return mAbsSendTimeOffset;
+  }
+
+  uint32_t getTransportSequenceNumberOffset() const {
+    return mTransportSequenceNumberOffset;
+  }
+
+  // CSRC と拡張ヘッダーを含めた RTP ヘッダーの長さを返します。
+  // 不正なパケットの場合には 0 を返します。
+  static uint32_t parseHeaderLength(const uint8_t *data, uint32_t len) {
+    if (len < RTP_HEADER_LEN) {
+      return 0;
+    }
+    uint32_t headerLen = RTP_HEADER_LEN + (data[0] & 0x0F) * 4;
+    if (data[0] & 0x10) {
+      if (len < headerLen + 4) {
+        return 0;
+      }
+      headerLen += 4 + (((data[headerLen + 2] << 8) | data[headerLen + 3]) * 4);
+    }
+    return (headerLen <= len) ? headerLen : 0;
+  }
+
+  // abs-send-time は 6.18 固定小数点の秒 (24 bit) です。
+  static inline uint32_t toAbsSendTime(uint64_t timeUs) {
+    return (uint32_t)(((timeUs << 18) / 1000000) & 0x00FFFFFF);
+  }
+
+  static inline void writeAbsSendTime(uint8_t *p, uint32_t absSendTime) {
+    p[0] = (absSendTime >> 16) & 0xFF;
+    p[1] = (absSendTime >> 8) & 0xFF;
+    p[2] = absSendTime & 0xFF;
+  }
+
+  static inline void writeTransportSequenceNumber(uint8_t *p, uint16_t sequenceNumber) {
+    p[0] = (sequenceNumber >> 8) & 0xFF;
+    p[1] = sequenceNumber & 0xFF;
+  }
+
+  // flags には RTP_FRAME_MARKING_* を指定します。
+  static inline void writeFrameMarking(uint8_t *p, uint8_t flags, uint8_t temporalLayerId, uint8_t layerId, uint8_t tl0PicIdx) {
+    p[0] = (flags & 0xF8) | (temporalLayerId & 0x07);
+    p[1] = layerId;
+    p[2] = tl0PicIdx;
+  }
+
+  inline uint32_t size() const {
+    return mSize;
+  }
+
+  inline void write(uint8_t *out, uint16_t sequenceNumber, uint32_t timestamp, bool mark) const {
+    memcpy(out, mTemplate, mSize);
+    if (mark) {
+      out[1] |= 0x80;
+    }
+    out[2] = (sequenceNumber >> 8) & 0xFF;
+    out[3] = sequenceNumber & 0xFF;
+    out[4] = (timestamp >> 24) & 0xFF;
+    out[5] = (timestamp >> 16) & 0xFF;
+    out[6] = (timestamp >> 8) & 0xFF;
+    out[7] = timestamp & 0xFF;
+  }
+};
@@ -1,14 +1,58 @@
 #include "RTPSender.h"
+#include "RTCPPacket.h"
+#include "../utils/TimeUtils.h"
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <random>
+
+// RTCP SR を送信する平均間隔
+#define RTCP_SR_INTERVAL_US 1000000
+
+// NACK の統計情報をログに出力する間隔
+#define RTP_NACK_REPORT_INTERVAL_US 10000000
 
 RTPSender::RTPSender()
 {
+  mSocket = nullptr;
+  memset(&mDestAddr, 0, sizeof(mDestAddr));
+  memset(&mDestRtcpAddr, 0, sizeof(mDestRtcpAddr));
   mDestIP[0] = 127;
   mDestIP[1] = 0;
   mDestIP[2] = 0;
   mDestIP[3] = 1;
   mDestPort = 6664;
-  mPortBase = 0;
+  mDestRtcpPort = 0;
+  mSSRC = 0;
+  mSequenceNumber = 0;
+  mTimestamp = 0;
+  mTimestampOffset = 0;
   mMark = false;
+  mPacingEnabled = false;
+  mRtxEnabled = false;
+  mRtxPayloadType = 0;
+  mRtxSSRC = 0;
+  mRtxSequenceNumber = 0;
+  mTransportSequenceNumber = 0;
+  mCongestionControlEnabled = false;
+  mFrameMarkingFlags = 0;
+  mTemporalLayerId = 0;
+  mTL0PicIdx = 0;
+  mFrameStart = false;
+  mNackCount = 0;
+  mRetransmitCount = 0;
+  mRetransmitNotFoundCount = 0;
+  mRetransmitTooOldCount = 0;
+  mRetransmitRateLimitedCount = 0;
+  mLastNackReportTimeUs = 0;
+  mLastFirSequenceNumber = -1;
+  mReceiverReportCount = 0;
+  mFractionLost = 0;
+  mClock = nullptr;
+  mPacketCount = 0;
+  mOctetCount = 0;
+  mLastSenderReportTimeUs = 0;
+  mSenderReportIntervalUs = RTCP_SR_INTERVAL_US;
 }
 
 RTPSender::~RTPSender()
@@ -18,12 +62,17 @@ RTPSender::~RTPSender()
 
 int RTPSender::getLocalSSRC()
 {
-  return mSession.GetLocalSSRC();
+  return mSSRC;
+}
+
+int RTPSender::getRtxSSRC()
+{
+  return mRtxEnabled ? mRtxSSRC : 0;
 }
 
 bool RTPSender::isActive()
 {
-  return mSession.IsActive();
+  return mSocket != nullptr;
 }
 
 void RTPSender::setPayloadType(uint8_t type)
@@ -36,9 +85,14 @@ void RTPSender::setDestPort(int port)
   mDestPort = port;
 }
 
-void RTPSender::setPortBase(int port)
+void RTPSender::setDestRtcpPort(int port)
+{
+  mDestRtcpPort = port;
+}
+
+void RTPSender::setSocket(std::shared_ptr<RTPSocket> socket)
 {
-  mPortBase = port;
+  mSocket = socket;
 }
 
 void RTPSender::setFrequency(double freq)
@@ -56,6 +110,66 @@ void RTPSender::setMark(bool m)
   mMark = m;
 }
 
+void RTPSender::setBatchSize(int size)
+{
+  mBatch.setMaxBatchSize(size);
+}
+
+void RTPSender::setGsoEnabled(bool enabled)
+{
+  mBatch.setGsoEnabled(enabled);
+}
+
+void RTPSender::setPacing(bool enabled, double multiplier, uint32_t minBitrate, uint32_t maxDelay)
+{
+  mPacingEnabled = enabled;
+  mPacer.setMultiplier(multiplier);
+  mPacer.setMinBitrate(minBitrate);
+  mPacer.setMaxDelay(maxDelay);
+}
+
+void RTPSender::setMediaClock(std::shared_ptr<MediaClock> clock)
+{
+  mClock = clock;
+}
+
+void RTPSender::setHeaderExtensions(const std::string& mid)
+{
+  mHeader.setExtensions(RTP_EXTENSION_ID_MID, mid, RTP_EXTENSION_ID_ABS_SEND_TIME, RTP_EXTENSION_ID_TRANSPORT_WIDE_CC);
+}
+
+void RTPSender::setCongestionControl(bool enabled, uint32_t minBitrate, uint32_t maxBitrate)
+{
+  mCongestionControlEnabled = enabled;
+  mCongestionController.setBitrateRange(minBitrate, maxBitrate);
+}
+
+void RTPSender::setFrameMarking(bool enabled)
+{
+  mHeader.setFrameMarkingExtension(enabled ? RTP_EXTENSION_ID_FRAME_MARKING : 0);
+}
+
+void RTPSender::beginFrame(uint8_t flags, uint8_t temporalLayerId, uint8_t tl0PicIdx)
+{
+  mFrameMarkingFlags = flags;
+  mTemporalLayerId = temporalLayerId;
+  mTL0PicIdx = tl0PicIdx;
+  mFrameStart = true;
+}
+
+void RTPSender::setNack(bool enabled, uint32_t maxAge, uint32_t maxBitrate)
+{
+  mHistory.setEnabled(enabled);
+  mHistory.setMaxAge(maxAge);
+  mHistory.setMaxBitrate(maxBitrate);
+}
+
+void RTPSender::setRtxPayloadType(uint8_t payloadType)
+{
+  mRtxPayloadType = payloadType;
+  mRtxEnabled = (payloadType != 0);
+}
+
 void RTPSender::setDestIPAddress(std::string& ipaddress)
 {
   std::istringstream iss(ipaddress);
@@ -75,37 +189,544 @@ void RTPSender::setDestIPAddress(std::string& ipaddress)
 void RTPSender::open()
 {
   LOG_DEBUG("RTPSender is opened.\n");
-  LOG_DEBUG("    JRTPLIB Version: %s\n",RTPLibraryVersion::GetVersion().GetVersionString().c_str());
-  LOG_DEBUG("    destIP=%d.%d.%d.%d:%d\n", mDestIP[0],mDestIP[1],mDestIP[2],mDestIP[3],mDestPort);
- 
-  RTPSessionParams sessParams;
-  sessParams.SetAcceptOwnPackets(false);
-  sessParams.SetOwnTimestampUnit(1.0/mFrequency);
-  sessParams.SetUsePredefinedSSRC(false);
-
-  RTPUDPv4TransmissionParams transparams;
-  transparams.SetPortbase(mPortBase);
-
-  int status = mSession.Create(sessParams, &transparams);
-  if (status < 0) {
-    LOG_ERROR("Failed to create a RTPSession. status=%d error=%s\n", status, RTPGetErrorString(status).c_str());
+  LOG_DEBUG("    destIP=%d.%d.%d.%d:%d rtcp=%d\n", mDestIP[0],mDestIP[1],mDestIP[2],mDestIP[3],mDestPort,mDestRtcpPort);
+
+  if (!mSocket) {
+    LOG_ERROR("RTPSocket is not set.\n");
     return;
   }
 
-  RTPIPv4Address addr(mDestIP, mDestPort);
-  status = mSession.AddDestination(addr);
-  if (status < 0) {
-    LOG_ERROR("Failed to add a destination. status=%d error=%s\n", status, RTPGetErrorString(status).c_str());
-    return;
+  in_addr_t destAddr = htonl((mDestIP[0] << 24) | (mDestIP[1] << 16) | (mDestIP[2] << 8) | mDestIP[3]);
+
+  mDestAddr.sin_family = AF_INET;
+  mDestAddr.sin_addr.s_addr = destAddr;
+  mDestAddr.sin_port = htons(mDestPort);
+
+  mDestRtcpAddr.sin_family = AF_INET;
+  mDestRtcpAddr.sin_addr.s_addr = destAddr;
+  mDestRtcpAddr.sin_port = htons(mDestRtcpPort ? mDestRtcpPort : mDestPort);
+
+  // SSRC、シーケンス番号、タイムスタンプの初期値はランダムに決めます。
+  std::random_device rd;
+  std::mt19937 mt(rd());
+  mRandom.seed(rd());
+  mPacketCount = 0;
+  mOctetCount = 0;
+  mLastSenderReportTimeUs = 0;
+  mSSRC = mt();
+  mSequenceNumber = mt() & 0xFFFF;
+  mTimestampOffset = mt();
+  mTimestamp = mTimestampOffset;
+  do {
+    mRtxSSRC = mt();
+  } while (mRtxSSRC == mSSRC);
+  mRtxSequenceNumber = mt() & 0xFFFF;
+  mTransportSequenceNumber = mt() & 0xFFFF;
+
+  mHeader.init(mPayloadType, mSSRC);
+  mPacer.setAbsSendTimeOffset(mHeader.getAbsSendTimeOffset());
+  if (mCongestionControlEnabled && !mHeader.hasTransportSequenceNumber()) {
+    LOG_WARN("Congestion control requires transport-wide-cc header extension. ssrc=%u\n", mSSRC);
+    mCongestionControlEnabled = false;
+  }
+  if (mCongestionControlEnabled) {
+    mCongestionController.reset();
+    mPacer.setCongestionController(&mCongestionController, mHeader.getTransportSequenceNumberOffset());
+  } else {
+    mPacer.setCongestionController(nullptr, 0);
+  }
+  mBatch.setSocket(mSocket->getSocket());
+
+  if (mPacingEnabled) {
+    mPacer.setSSRC(mSSRC);
+    mSocket->addPacer(&mPacer);
+  }
+
+  // mediasoup から送られてくる RTCP は、RTCP ポート (rtcp-mux の場合は RTP ポート) から送信されてきます。
+  mSocket->addListener(&mDestRtcpAddr, mSSRC, this);
+  if (mRtxEnabled) {
+    mSocket->addListener(&mDestRtcpAddr, mRtxSSRC, this);
   }
 
-  mSession.SetDefaultTimestampIncrement(mTimestampIncrement);
-  mSession.SetDefaultPayloadType(mPayloadType);
-  mSession.SetDefaultMark(mMark);
-  mSession.SetMaximumPacketSize(MAXLEN + 100);
+  // comedia モードの mediasoup は、最初に受信した RTCP パケットの送信元に RTCP を返すので、
+  // 空の Receiver Report を送信して RTCP の送信先を通知しておきます。
+  uint8_t rr[8];
+  rr[0] = (RTP_VERSION << 6);
+  rr[1] = RTCP_PT_RR;
+  rr[2] = 0;
+  rr[3] = 1;
+  rr[4] = (mSSRC >> 24) & 0xFF;
+  rr[5] = (mSSRC >> 16) & 0xFF;
+  rr[6] = (mSSRC >> 8) & 0xFF;
+  rr[7] = mSSRC & 0xFF;
+  sendRtcp(rr, sizeof(rr));
 }
 
 void RTPSender::close()
 {
-  mSession.BYEDestroy(RTPTime(10, 0), 0, 0);
+  if (mSocket) {
+    mBatch.flush();
+    mBatch.setSocket(-1);
+    if (mPacingEnabled) {
+      mSocket->removePacer(&mPacer);
+    }
+    mSocket->removeListener(&mDestRtcpAddr, mSSRC);
+    if (mRtxEnabled) {
+      mSocket->removeListener(&mDestRtcpAddr, mRtxSSRC);
+    }
+    mSocket = nullptr;
+    mHistory.clear();
+  }
+}
+
+int RTPSender::sendRtcp(const uint8_t *data, uint32_t len)
+{
+  if (!mSocket) {
+    return -1;
+  }
+  return mSocket->sendTo(&mDestRtcpAddr, data, len);
+}
+
+void RTPSender::onReceivedRtcp(const uint8_t *data, uint32_t len)
+{
+  LOG_DEBUG("Received a rtcp packet. ssrc=%u len=%d\n", mSSRC, len);
+
+  uint32_t offset = 0;
+  while (offset + RTCP_HEADER_LEN <= len) {
+    const uint8_t *p = &data[offset];
+    uint32_t size = RTCPUtils::getPacketSize(p);
+    if (offset + size > len) {
+      break;
+    }
+
+    uint8_t pt = RTCPUtils::getPayloadType(p);
+    uint8_t fmt = RTCPUtils::getCount(p);
+    if (pt == RTCP_PT_SR || pt == RTCP_PT_RR) {
+      handleReceiverReport(p, size);
+    } else if (pt == RTCP_PT_RTPFB && fmt == RTCP_RTPFB_FMT_NACK) {
+      handleNack(p, size);
+    } else if (pt == RTCP_PT_RTPFB && fmt == RTCP_RTPFB_FMT_TRANSPORT_CC) {
+      if (mCongestionControlEnabled) {
+        mCongestionController.onTransportFeedback(p, size);
+      }
+    } else if (pt == RTCP_PT_PSFB && fmt == RTCP_PSFB_FMT_PLI) {
+      handlePli(p, size);
+    } else if (pt == RTCP_PT_PSFB && fmt == RTCP_PSFB_FMT_FIR) {
+      handleFir(p, size);
+    }
+    offset += size;
+  }
+
+  reportNackStats();
+}
+
+// Generic NACK
+// 0                   1                   2                   3
+// 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |V=2|P| FMT=1   |   PT=205      |          length               |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |                  SSRC of packet sender                        |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |                  SSRC of media source                         |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |            PID                |             BLP               |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// :                              ...                              :
+
+void RTPSender::handleNack(const uint8_t *data, uint32_t len)
+{
+  if (len < 12 || RTCPUtils::readUint32(&data[8]) != mSSRC) {
+    return;
+  }
+
+  if (!mHistory.isEnabled()) {
+    return;
+  }
+
+  for (uint32_t offset = 12; offset + 4 <= len; offset += 4) {
+    uint16_t pid = RTCPUtils::readUint16(&data[offset]);
+    uint16_t blp = RTCPUtils::readUint16(&data[offset + 2]);
+
+    retransmit(pid);
+    for (int i = 0; i < 16; i++) {
+      if (blp & (1 << i)) {
+        retransmit(pid + i + 1);
+      }
+    }
+  }
+}
+
+// Picture Loss Indication (PLI)
+// 0                   1                   2                   3
+// 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |V=2|P| FMT=1   |   PT=206      |          length=2             |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |                  SSRC of packet sender                        |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |                  SSRC of media source                         |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+
+void RTPSender::handlePli(const uint8_t *data, uint32_t len)
+{
+  if (len < 12 || RTCPUtils::readUint32(&data[8]) != mSSRC) {
+    return;
+  }
+  LOG_DEBUG("Received PLI. ssrc=%u\n", mSSRC);
+  onKeyframeRequested();
+}
+
+// Full Intra Request (FIR)
+// 0                   1                   2                   3
+// 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |V=2|P| FMT=4   |   PT=206      |          length               |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |                  SSRC of packet sender                        |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |                  SSRC of media source (unused) = 0            |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |                              SSRC                             |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// | Seq nr.       |    Reserved                                   |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+
+void RTPSender::handleFir(const uint8_t *data, uint32_t len)
+{
+  for (uint32_t offset = 12; offset + 8 <= len; offset += 8) {
+    if (RTCPUtils::readUint32(&data[offset]) != mSSRC) {
+      continue;
+    }
+
+    // 同じシーケンス番号の FIR は再送されたものなので無視します。
+    int sequenceNumber = data[offset + 4];
+    if (sequenceNumber == mLastFirSequenceNumber) {
+      return;
+    }
+    mLastFirSequenceNumber = sequenceNumber;
+
+    LOG_DEBUG("Received FIR. ssrc=%u seq=%d\n", mSSRC, sequenceNumber);
+    onKeyframeRequested();
+    return;
+  }
+}
+
+// Report Block
+// 0                   1                   2                   3
+// 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+// +=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+
+// |                 SSRC_1 (SSRC of first source)                 |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// | fraction lost |       cumulative number of packets lost       |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |           extended highest sequence number received           |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |                      interarrival jitter                      |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |                         last SR (LSR)                         |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |                   delay since last SR (DLSR)                  |
+// +=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+
+#define RTCP_REPORT_BLOCK_LEN 24
+
+// SR/RR に含まれる自分の SSRC 宛ての Report Block から、パケットロス率を取り出します。
+void RTPSender::handleReceiverReport(const uint8_t *data, uint32_t len)
+{
+  // SR の場合には、Report Block の前に 20 バイトの Sender Info があります。
+  uint32_t offset = (RTCPUtils::getPayloadType(data) == RTCP_PT_SR) ? 28 : 8;
+  int count = RTCPUtils::getCount(data);
+  for (int i = 0; i < count && offset + RTCP_REPORT_BLOCK_LEN <= len; i++) {
+    const uint8_t *block = &data[offset];
+    offset += RTCP_REPORT_BLOCK_LEN;
+    if (RTCPUtils::readUint32(block) != mSSRC) {
+      continue;
+    }
+
+    mFractionLost = block[4];
+    mReceiverReportCount++;
+    LOG_DEBUG("Received report block. ssrc=%u fractionLost=%u\n", mSSRC, block[4]);
+  }
+}
+
+// RTX Packet
+// 0                   1                   2                   3
+// 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |                         RTP Header                            |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |            OSN                |                               |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+                               |
+// |                  Original RTP Packet Payload                  |
+// |                                                               |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+
+// 元の RTP パケットから RTX パケットを作成します。
+// RTP ヘッダーの payload type、シーケンス番号、SSRC を RTX のものに置き換えて、
+// payload の前に元のシーケンス番号 (OSN) を付加します。
+uint32_t RTPSender::makeRtxPacket(const uint8_t *packet, uint32_t packetLen, uint8_t *out)
+{
+  uint32_t headerLen = RTPHeader::parseHeaderLength(packet, packetLen);
+  if (headerLen == 0) {
+    return 0;
+  }
+
+  memcpy(out, packet, headerLen);
+  out[1] = (packet[1] & 0x80) | (mRtxPayloadType & 0x7F);
+  RTCPUtils::writeUint16(&out[2], mRtxSequenceNumber++);
+  RTCPUtils::writeUint32(&out[8], mRtxSSRC);
+  out[headerLen] = packet[2];
+  out[headerLen + 1] = packet[3];
+  memcpy(&out[headerLen + 2], &packet[headerLen], packetLen - headerLen);
+  return packetLen + 2;
+}
+
+void RTPSender::retransmit(uint16_t sequenceNumber)
+{
+  uint8_t packet[RTP_MAX_PACKET_SIZE];
+  uint8_t rtxPacket[RTP_MAX_PACKET_SIZE + 2];
+  uint32_t packetLen = 0;
+
+  mNackCount++;
+
+  switch (mHistory.get(sequenceNumber, packet, &packetLen)) {
+    case RTPHistory::Retransmit:
+      // 再送するパケットも新しい送信時刻と transport-wide-cc のシーケンス番号で送信します。
+      writeHeaderExtensions(packet);
+      if (mRtxEnabled) {
+        uint32_t rtxPacketLen = makeRtxPacket(packet, packetLen, rtxPacket);
+        if (rtxPacketLen > 0 && mSocket && mSocket->sendTo(&mDestAddr, rtxPacket, rtxPacketLen) >= 0) {
+          notifyPacketSent(packet, rtxPacketLen);
+          mRetransmitCount++;
+        }
+      } else {
+        if (mSocket && mSocket->sendTo(&mDestAddr, packet, packetLen) >= 0) {
+          notifyPacketSent(packet, packetLen);
+          mRetransmitCount++;
+        }
+      }
+      break;
+    case RTPHistory::NotFound:
+      mRetransmitNotFoundCount++;
+      break;
+    case RTPHistory::TooOld:
+      mRetransmitTooOldCount++;
+      break;
+    case RTPHistory::RateLimited:
+      mRetransmitRateLimitedCount++;
+      break;
+    case RTPHistory::TooSoon:
+    default:
+      break;
+  }
+}
+
+void RTPSender::reportNackStats()
+{
+  uint64_t now = TimeUtils::GetMonotonicTimeUs();
+  if (mLastNackReportTimeUs == 0) {
+    mLastNackReportTimeUs = now;
+    return;
+  }
+
+  if (now - mLastNackReportTimeUs < RTP_NACK_REPORT_INTERVAL_US) {
+    return;
+  }
+  mLastNackReportTimeUs = now;
+
+  if (mNackCount > 0) {
+    LOG_INFO("RTPSender ssrc=%u nack=%u retransmitted=%u notFound=%u tooOld=%u rateLimited=%u\n",
+        mSSRC, mNackCount, mRetransmitCount, mRetransmitNotFoundCount,
+        mRetransmitTooOldCount, mRetransmitRateLimitedCount);
+  }
+
+  mNackCount = 0;
+  mRetransmitCount = 0;
+  mRetransmitNotFoundCount = 0;
+  mRetransmitTooOldCount = 0;
+  mRetransmitRateLimitedCount = 0;
+}
+
+uint32_t RTPSender::toRtpTimestamp(int64_t timeMs)
+{
+  return mTimestampOffset + (uint32_t)(timeMs * (int64_t)mFrequency / 1000);
+}
+
+int RTPSender::sendPacket(const struct iovec *payload, int payloadCount, bool mark, uint32_t timestampIncrement,
+    const uint8_t *payloadHeader, uint32_t payloadHeaderLen)
+{
+  if (!mSocket) {
+    return -1;
+  }
+
+  uint32_t payloadLen = payloadHeaderLen;
+  for (int i = 0; i < payloadCount; i++) {
+    payloadLen += payload[i].iov_len;
+  }
+
+  if (mPacingEnabled) {
+    // トークンが足りない場合には、RTP ヘッダーを付けてペーサーのキューに入れます。
+    // キューに入れたパケットは RTPPacerThread から送信されます。
+    if (!mPacer.trySend(mHeader.size() + payloadLen)) {
+      uint8_t header[RTP_BATCH_HEADER_SIZE];
+      struct iovec iov[RTP_MAX_IOV + 1];
+      if (payloadCount > RTP_MAX_IOV || payloadHeaderLen > RTP_MAX_PAYLOAD_HEADER_LEN) {
+        return -1;
+      }
+
+      // キューが空の時に溜まっているバッチは、キューに入れるパケットより先に送信しておかないと
+      // RTPPacerThread から送信されるパケットと順番が入れ替わってしまいます。
+      if (mPacer.getQueueSize() == 0) {
+        mBatch.flush();
+      }
+
+      mHeader.write(header, mSequenceNumber, mTimestamp, mark);
+      writeHeaderExtensions(header);
+      writeFrameMarking(header, mark);
+      if (payloadHeaderLen > 0) {
+        memcpy(&header[mHeader.size()], payloadHeader, payloadHeaderLen);
+      }
+      mHistory.add(mSequenceNumber, header, mHeader.size() + payloadHeaderLen, payload, payloadCount);
+      iov[0].iov_base = header;
+      iov[0].iov_len = mHeader.size() + payloadHeaderLen;
+      for (int i = 0; i < payloadCount; i++) {
+        iov[i + 1] = payload[i];
+      }
+      mPacer.enqueue(&mDestAddr, iov, payloadCount + 1);
+
+      mPacketCount++;
+      mOctetCount += payloadLen;
+      mSequenceNumber++;
+      mTimestamp += timestampIncrement;
+      return 0;
+    }
+  }
+
+  uint8_t *header = mBatch.add(&mDestAddr, payload, payloadCount, mHeader.size(), payloadHeader, payloadHeaderLen);
+  if (!header) {
+    return -1;
+  }
+  mHeader.write(header, mSequenceNumber, mTimestamp, mark);
+  writeHeaderExtensions(header);
+  writeFrameMarking(header, mark);
+  notifyPacketSent(header, mHeader.size() + payloadLen);
+  mHistory.add(mSequenceNumber, header, mHeader.size() + payloadHeaderLen, payload, payloadCount);
+
+  mPacketCount++;
+  mOctetCount += payloadLen;
+  mSequenceNumber++;
+  mTimestamp += timestampIncrement;
+  return 0;
+}
+
+// 送信ごとに変わる拡張ヘッダーの値を書き込みます。
+void RTPSender::writeHeaderExtensions(uint8_t *header)
+{
+  if (mHeader.hasAbsSendTime()) {
+    RTPHeader::writeAbsSendTime(&header[mHeader.getAbsSendTimeOffset()],
+        RTPHeader::toAbsSendTime(TimeUtils::GetMonotonicTimeUs()));
+  }
+  if (mHeader.hasTransportSequenceNumber()) {
+    RTPHeader::writeTransportSequenceNumber(&header[mHeader.getTransportSequenceNumberOffset()],
+        mTransportSequenceNumber++);
+  }
+}
+
+// フレームの最初のパケットには S、マーカーを付けた最後のパケットには E のビットを付けます。
+// 再送するパケットは保持している値をそのまま使用するので、新しく送信するパケットだけに書き込みます。
+void RTPSender::writeFrameMarking(uint8_t *header, bool mark)
+{
+  if (!mHeader.hasFrameMarking()) {
+    return;
+  }
+
+  uint8_t flags = mFrameMarkingFlags;
+  if (mFrameStart) {
+    flags |= RTP_FRAME_MARKING_START;
+    mFrameStart = false;
+  }
+  if (mark) {
+    flags |= RTP_FRAME_MARKING_END;
+  }
+  RTPHeader::writeFrameMarking(&header[mHeader.getFrameMarkingOffset()], flags, mTemporalLayerId, 0, mTL0PicIdx);
+}
+
+// 輻輳制御に送信したパケットの transport-wide-cc のシーケンス番号と送信時刻を通知します。
+// キューに入れたパケットは、RTPPacer が実際に送信する時に通知します。
+void RTPSender::notifyPacketSent(const uint8_t *header, uint32_t size)
+{
+  if (!mCongestionControlEnabled) {
+    return;
+  }
+  uint16_t transportSequenceNumber = RTCPUtils::readUint16(&header[mHeader.getTransportSequenceNumberOffset()]);
+  mCongestionController.onPacketSent(transportSequenceNumber, size, TimeUtils::GetMonotonicTimeUs());
+}
+
+int RTPSender::flush()
+{
+  int ret = mBatch.flush();
+  sendSenderReportIfNeeded();
+  return ret;
+}
+
+void RTPSender::sendSenderReportIfNeeded()
+{
+  uint64_t now = TimeUtils::GetMonotonicTimeUs();
+  if (mLastSenderReportTimeUs != 0 && now - mLastSenderReportTimeUs < mSenderReportIntervalUs) {
+    return;
+  }
+
+  if (sendSenderReport() == 0) {
+    mLastSenderReportTimeUs = now;
+    // RFC 3550 に従って、送信間隔を [0.5, 1.5] 倍の範囲でランダムにします。
+    mSenderReportIntervalUs = RTCP_SR_INTERVAL_US / 2 + mRandom() % RTCP_SR_INTERVAL_US;
+  }
+}
+
+// Sender Report (SR)
+// 0                   1                   2                   3
+// 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |V=2|P|    RC   |   PT=SR=200   |             length            |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |                         SSRC of sender                        |
+// +=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+
+// |              NTP timestamp, most significant word             |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |             NTP timestamp, least significant word             |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |                         RTP timestamp                         |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |                     sender's packet count                     |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |                      sender's octet count                     |
+// +=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+
+
+int RTPSender::sendSenderReport()
+{
+  if (!mClock || mPacketCount == 0) {
+    return -1;
+  }
+
+  // 共有している時計から、現在の wallclock に対応する RTP タイムスタンプを計算します。
+  // 映像と音声で同じ時計を使うので、受信側で同期を取ることができます。
+  uint64_t now = TimeUtils::GetWallClockTimeUs();
+  int64_t mediaTimeUs = 0;
+  if (!mClock->getMediaTimeAt(now, &mediaTimeUs)) {
+    return -1;
+  }
+  uint32_t rtpTimestamp = mTimestampOffset + (uint32_t)(mediaTimeUs * (int64_t)mFrequency / 1000000);
+  uint64_t ntpTime = TimeUtils::ToNtpTime(now);
+
+  uint8_t sr[28];
+  sr[0] = (RTP_VERSION << 6);
+  sr[1] = RTCP_PT_SR;
+  RTCPUtils::writeUint16(&sr[2], sizeof(sr) / 4 - 1);
+  RTCPUtils::writeUint32(&sr[4], mSSRC);
+  RTCPUtils::writeUint32(&sr[8], (uint32_t)(ntpTime >> 32));
+  RTCPUtils::writeUint32(&sr[12], (uint32_t)(ntpTime & 0xFFFFFFFF));
+  RTCPUtils::writeUint32(&sr[16], rtpTimestamp);
+  RTCPUtils::writeUint32(&sr[20], mPacketCount);
+  RTCPUtils::writeUint32(&sr[24], mOctetCount);
+  return sendRtcp(sr, sizeof(sr)) < 0 ? -1 : 0;
 }
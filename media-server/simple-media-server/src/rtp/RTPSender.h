@@ -1,34 +1,124 @@
 #pragma once
 
-#include <jrtplib3/rtpsession.h>
-#include <jrtplib3/rtpudpv4transmitter.h>
-#include <jrtplib3/rtpipv4address.h>
-#include <jrtplib3/rtpsessionparams.h>
-#include <jrtplib3/rtperrors.h>
-#include <jrtplib3/rtplibraryversion.h>
+#include <netinet/in.h>
+#include <sys/uio.h>
 #include <iostream>
+#include <atomic>
+#include <memory>
+#include <random>
 #include <string>
 #include <sstream>
 
+#include "RTPBatch.h"
+#include "RTPCongestionController.h"
+#include "RTPHistory.h"
+#include "MediaClock.h"
+#include "RTPPacer.h"
+#include "RTPPacket.h"
+#include "RTPSocket.h"
 #include "../utils/Log.h"
 
-using namespace jrtplib;
-
-#define RTP_HEADER_LEN 12
-
-#define MAXLEN (RTP_DEFAULTPACKETSIZE - 100 - RTP_HEADER_LEN)
-
-class RTPSender {
+class RTPSender : public RTCPListener {
 protected:
-  RTPSession mSession;
+  std::shared_ptr<RTPSocket> mSocket;
+  struct sockaddr_in mDestAddr;
+  struct sockaddr_in mDestRtcpAddr;
+  RTPHeader mHeader;
+  RTPBatch mBatch;
+  RTPPacer mPacer;
+  bool mPacingEnabled;
+  RTPHistory mHistory;
+  // RTX (RFC 4588)
+  bool mRtxEnabled;
+  uint8_t mRtxPayloadType;
+  uint32_t mRtxSSRC;
+  uint16_t mRtxSequenceNumber;
+  // transport-wide-cc のシーケンス番号
+  // 送信スレッドと RTCP の受信スレッド (再送) の両方から使用します。
+  std::atomic<uint16_t> mTransportSequenceNumber;
+  // transport-cc のフィードバックによる帯域の推定
+  RTPCongestionController mCongestionController;
+  bool mCongestionControlEnabled;
+  // 送信中のフレームの frame-marking (beginFrame で設定します)
+  uint8_t mFrameMarkingFlags;
+  uint8_t mTemporalLayerId;
+  uint8_t mTL0PicIdx;
+  bool mFrameStart;
+  uint32_t mSSRC;
+  uint16_t mSequenceNumber;
+  uint32_t mTimestamp;
+  // RTP タイムスタンプの初期値 (ランダム)
+  uint32_t mTimestampOffset;
   uint8_t mPayloadType;
   uint8_t mDestIP[4];
   uint16_t mDestPort;
-  uint16_t mPortBase;
+  uint16_t mDestRtcpPort;
   double mFrequency;
   uint32_t mTimestampIncrement;
   bool mMark;
 
+  // NACK による再送の統計情報 (RTCP の受信スレッドからのみ更新します)
+  uint32_t mNackCount;
+  uint32_t mRetransmitCount;
+  uint32_t mRetransmitNotFoundCount;
+  uint32_t mRetransmitTooOldCount;
+  uint32_t mRetransmitRateLimitedCount;
+  uint64_t mLastNackReportTimeUs;
+  // 最後に受信した FIR のシーケンス番号
+  int mLastFirSequenceNumber;
+  // 受信した Report Block (RTCP の受信スレッドで更新し、送信スレッドから参照します)
+  std::atomic<uint32_t> mReceiverReportCount;
+  std::atomic<uint8_t> mFractionLost;
+
+  // RTCP SR
+  std::shared_ptr<MediaClock> mClock;
+  std::mt19937 mRandom;
+  uint32_t mPacketCount;
+  uint32_t mOctetCount;
+  uint64_t mLastSenderReportTimeUs;
+  uint64_t mSenderReportIntervalUs;
+
+  void sendSenderReportIfNeeded();
+  int sendSenderReport();
+
+  void handleNack(const uint8_t *data, uint32_t len);
+  void writeHeaderExtensions(uint8_t *header);
+  void notifyPacketSent(const uint8_t *header, uint32_t size);
+  void writeFrameMarking(uint8_t *header, bool mark);
+  uint32_t makeRtxPacket(const uint8_t *packet, uint32_t packetLen, uint8_t *out);
+  void retransmit(uint16_t sequenceNumber);
+  void reportNackStats();
+  void handleReceiverReport(const uint8_t *data, uint32_t len);
+  void handlePli(const uint8_t *data, uint32_t len);
+  void handleFir(const uint8_t *data, uint32_t len);
+
+  // 送信先までの推定ビットレート (bps) を返します。輻輳制御が無効な場合には 0 を返します。
+  uint32_t getTargetBitrate() {
+    return mCongestionControlEnabled ? mCongestionController.getTargetBitrate() : 0;
+  }
+
+  // これから送信するフレームの frame-marking を設定します。
+  // flags には RTP_FRAME_MARKING_INDEPENDENT などを指定します。S と E のビットはパケットごとに付加します。
+  void beginFrame(uint8_t flags, uint8_t temporalLayerId, uint8_t tl0PicIdx);
+
+  // PLI/FIR でキーフレームが要求された時に RTCP の受信スレッドから呼び出されます。
+  virtual void onKeyframeRequested() {}
+
+  // payload に指定された iovec の前に RTP ヘッダーを付加して送信キューに追加します。
+  // 実際の送信は flush が呼び出されたか、バッチが一杯になった時に行われます。
+  // 追加後にタイムスタンプを timestampIncrement だけ進めます。
+  // payloadHeader は RTP ヘッダーの直後にコピーされるので、スタック上のバッファを渡しても構いません。
+  int sendPacket(const struct iovec *payload, int payloadCount, bool mark, uint32_t timestampIncrement,
+      const uint8_t *payloadHeader = nullptr, uint32_t payloadHeaderLen = 0);
+  int sendRtcp(const uint8_t *data, uint32_t len);
+  // ミリ秒単位のメディア時刻を RTP タイムスタンプに変換します。
+  uint32_t toRtpTimestamp(int64_t timeMs);
+  // RTMP のタイムスタンプをメディア時刻 (ミリ秒) に変換します。
+  // 時計が設定されていない場合には、そのまま返します。
+  int64_t toMediaTime(uint32_t rtmpTimestamp) {
+    return mClock ? mClock->toMediaTime(rtmpTimestamp) : rtmpTimestamp;
+  }
+
 public:
   RTPSender();
   virtual ~RTPSender();
@@ -36,16 +126,49 @@ public:
   void setDestIPAddress(std::string& ipaddress);
   void setPayloadType(uint8_t type);
   void setDestPort(int port);
-  // 0 を指定することで自動でポートを指定します。
-  // RTPUDPv4TransmissionParams::SetAllowOddPortbase が呼び出されない限り、これは偶数である必要があります。
-  void setPortBase(int port);
+  void setDestRtcpPort(int port);
+  // 送信に使用するソケットを設定します。ソケットは複数の RTPSender で共有されます。
+  void setSocket(std::shared_ptr<RTPSocket> socket);
   void setFrequency(double freq);
   void setTimestampIncrement(uint32_t increment);
   void setMark(bool m);
+  void setBatchSize(int size);
+  void setGsoEnabled(bool enabled);
+  // ペーシングの設定を行います。open の前に呼び出してください。
+  // multiplier は計測したビットレートに対する送信レートの倍率、minBitrate は送信レートの下限 (bps)、
+  // maxDelay はキューに入れたパケットを保持する最大時間 (ミリ秒) です。
+  void setPacing(bool enabled, double multiplier, uint32_t minBitrate, uint32_t maxDelay);
+  // NACK による再送の設定を行います。open の前に呼び出してください。
+  // maxAge より古いパケットは再送せず、再送のビットレートは maxBitrate (bps) までに制限します。
+  void setNack(bool enabled, uint32_t maxAge, uint32_t maxBitrate);
+  // 再送を RTX ストリームで行う場合に RTX の payload type を指定します。0 の場合には元の SSRC で再送します。
+  void setRtxPayloadType(uint8_t payloadType);
+  // 同じストリームの映像と音声で共有する時計を設定します。
+  // 時計が設定されている場合には、RTCP SR を定期的に送信します。
+  void setMediaClock(std::shared_ptr<MediaClock> clock);
+  // mid、abs-send-time、transport-wide-cc の拡張ヘッダーを付加します。open の前に呼び出してください。
+  void setHeaderExtensions(const std::string& mid);
+  // transport-cc のフィードバックによる帯域の推定を行います。open の前に呼び出してください。
+  // 拡張ヘッダーで transport-wide-cc のシーケンス番号を付加している場合にのみ有効になります。
+  void setCongestionControl(bool enabled, uint32_t minBitrate, uint32_t maxBitrate);
+  // frame-marking の拡張ヘッダーを付加します。open の前に呼び出してください。
+  void setFrameMarking(bool enabled);
   int getLocalSSRC();
+  int getRtxSSRC();
+  // 受信した Report Block の数です。新しい Report Block を受信したかを確認するのに使用します。
+  uint32_t getReceiverReportCount() {
+    return mReceiverReportCount;
+  }
+  // 最後に受信した Report Block の fraction lost (パケットロス率 x 256)
+  uint8_t getFractionLost() {
+    return mFractionLost;
+  }
   bool isActive();
 
-  virtual void open();
-  virtual void close();
-  virtual void send(const char *data, const uint32_t dataLen) = 0;
+  void open();
+  void close();
+  int flush();
+
+  // RTCPListener implements.
+  virtual void onReceivedRtcp(const uint8_t *data, uint32_t len) override;
 };
@@ -0,0 +1,295 @@
+#include "RTPSocket.h"
+#include "RTCPPacket.h"
+#include "../utils/Log.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <set>
+#include <thread>
+
+#define RTCP_RECV_BUFFER_SIZE 2048
+#define RTCP_POLL_TIMEOUT_MS 200
+
+RTPSocket::RTPSocket()
+{
+  mSocket = -1;
+  mPort = 0;
+  mRunning = false;
+}
+
+RTPSocket::~RTPSocket()
+{
+  close();
+}
+
+bool RTPSocket::open(uint16_t port)
+{
+  if (mSocket >= 0) {
+    LOG_ERROR("RTPSocket has already been opened.\n");
+    return false;
+  }
+
+  int sockfd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (sockfd < 0) {
+    LOG_ERROR("Failed to create a socket. error=%s\n", strerror(errno));
+    return false;
+  }
+
+  // 多数のストリームを 1 つのソケットで送信するので、送信バッファを大きくしておきます。
+  int bufSize = 4 * 1024 * 1024;
+  setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &bufSize, sizeof(bufSize));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if (bind(sockfd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+    LOG_ERROR("Failed to bind a socket. port=%d error=%s\n", port, strerror(errno));
+    ::close(sockfd);
+    return false;
+  }
+
+  socklen_t addrlen = sizeof(addr);
+  if (getsockname(sockfd, (struct sockaddr *) &addr, &addrlen) == 0) {
+    mPort = ntohs(addr.sin_port);
+  }
+
+  mSocket = sockfd;
+  mRunning = true;
+  startThread();
+  if (isStopped()) {
+    mRunning = false;
+  }
+
+  mPacerThread.start(mSocket);
+
+  LOG_INFO("RTPSocket is opened. port=%d\n", mPort);
+  return true;
+}
+
+void RTPSocket::close()
+{
+  if (mSocket < 0) {
+    return;
+  }
+
+  mPacerThread.stop();
+
+  stopThread();
+
+  // 受信スレッドが終了するのを待ちます。
+  while (mRunning) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+
+  ::close(mSocket);
+  mSocket = -1;
+
+  std::lock_guard<std::mutex> lock(mListenerMutex);
+  mListeners.clear();
+  mSsrcListeners.clear();
+}
+
+int RTPSocket::sendTo(const struct sockaddr_in *dest, const uint8_t *data, uint32_t len)
+{
+  if (mSocket < 0) {
+    return -1;
+  }
+
+  ssize_t ret = sendto(mSocket, data, len, 0, (const struct sockaddr *) dest, sizeof(struct sockaddr_in));
+  if (ret < 0) {
+    LOG_ERROR("Failed to send a packet. error=%s\n", strerror(errno));
+    return -1;
+  }
+  return ret;
+}
+
+uint64_t RTPSocket::makeKey(const struct sockaddr_in *addr)
+{
+  return ((uint64_t)ntohl(addr->sin_addr.s_addr) << 16) | ntohs(addr->sin_port);
+}
+
+void RTPSocket::addListener(const struct sockaddr_in *from, uint32_t ssrc, RTCPListener *listener)
+{
+  std::lock_guard<std::mutex> lock(mListenerMutex);
+  mListeners[makeKey(from)][ssrc] = listener;
+  mSsrcListeners[ssrc] = listener;
+}
+
+void RTPSocket::removeListener(const struct sockaddr_in *from, uint32_t ssrc)
+{
+  std::lock_guard<std::mutex> lock(mListenerMutex);
+  auto it = mListeners.find(makeKey(from));
+  if (it != mListeners.end()) {
+    it->second.erase(ssrc);
+    if (it->second.empty()) {
+      mListeners.erase(it);
+    }
+  }
+  mSsrcListeners.erase(ssrc);
+}
+
+void RTPSocket::addPacer(RTPPacer *pacer)
+{
+  mPacerThread.addPacer(pacer);
+}
+
+void RTPSocket::removePacer(RTPPacer *pacer)
+{
+  mPacerThread.removePacer(pacer);
+}
+
+void RTPSocket::runThread()
+{
+  uint8_t buf[RTCP_RECV_BUFFER_SIZE];
+
+  while (!isStopped()) {
+    struct pollfd fds;
+    fds.fd = mSocket;
+    fds.events = POLLIN;
+    fds.revents = 0;
+
+    int ret = poll(&fds, 1, RTCP_POLL_TIMEOUT_MS);
+    if (ret <= 0 || !(fds.revents & POLLIN)) {
+      continue;
+    }
+
+    struct sockaddr_in from;
+    socklen_t fromlen = sizeof(from);
+    ssize_t len = recvfrom(mSocket, buf, sizeof(buf), 0, (struct sockaddr *) &from, &fromlen);
+    if (len <= 0) {
+      continue;
+    }
+
+    // rtcp-mux の場合には同じポートに RTP が届く可能性もあるので、RTCP だけを通知します。
+    if (!RTCPUtils::isRtcp(buf, len)) {
+      LOG_DEBUG("Drop a non-RTCP packet. %s:%d len=%zd\n", inet_ntoa(from.sin_addr), ntohs(from.sin_port), len);
+      continue;
+    }
+
+    dispatch(&from, buf, len);
+  }
+
+  mRunning = false;
+}
+
+void RTPSocket::parseSsrcs(const uint8_t *data, uint32_t len, std::vector<uint32_t>& ssrcs)
+{
+  uint32_t offset = 0;
+  while (offset + 8 <= len) {
+    const uint8_t *p = &data[offset];
+    uint8_t count = RTCPUtils::getCount(p);
+    uint8_t pt = RTCPUtils::getPayloadType(p);
+    uint32_t size = RTCPUtils::getPacketSize(p);
+    if (offset + size > len) {
+      break;
+    }
+
+    if (pt == RTCP_PT_SR || pt == RTCP_PT_RR) {
+      // Report Block の SSRC
+      uint32_t blockOffset = (pt == RTCP_PT_SR) ? 28 : 8;
+      for (int i = 0; i < count && blockOffset + 24 <= size; i++, blockOffset += 24) {
+        ssrcs.push_back(RTCPUtils::readUint32(&p[blockOffset]));
+      }
+    } else if ((pt == RTCP_PT_RTPFB || pt == RTCP_PT_PSFB) && size >= 12) {
+      // Feedback Message の media source SSRC
+      ssrcs.push_back(RTCPUtils::readUint32(&p[8]));
+    }
+    offset += size;
+  }
+}
+
+void RTPSocket::dispatch(const struct sockaddr_in *from, const uint8_t *data, uint32_t len)
+{
+  std::lock_guard<std::mutex> lock(mListenerMutex);
+
+  auto it = mListeners.find(makeKey(from));
+  if (it != mListeners.end() && it->second.size() == 1) {
+    it->second.begin()->second->onReceivedRtcp(data, len);
+    return;
+  }
+
+  // 同じ送信元に複数の SSRC が登録されている場合や、送信元が分からない場合には、
+  // compound packet に含まれる SSRC を見て通知先を決めます。
+  std::vector<uint32_t> ssrcs;
+  parseSsrcs(data, len, ssrcs);
+
+  auto& listeners = (it != mListeners.end()) ? it->second : mSsrcListeners;
+  std::set<RTCPListener *> targets;
+  for (uint32_t ssrc : ssrcs) {
+    auto l = listeners.find(ssrc);
+    if (l != listeners.end()) {
+      targets.insert(l->second);
+    }
+  }
+
+  if (targets.empty()) {
+    if (it == mListeners.end()) {
+      LOG_DEBUG("Received a packet from unknown address. %s:%d\n", inet_ntoa(from->sin_addr), ntohs(from->sin_port));
+      return;
+    }
+    // SSRC で振り分けられない場合には、送信元に登録されている全てに通知します。
+    for (auto& l : listeners) {
+      targets.insert(l.second);
+    }
+  }
+
+  for (auto listener : targets) {
+    listener->onReceivedRtcp(data, len);
+  }
+}
+
+
+RTPSocketPool::RTPSocketPool()
+{
+  mNextIndex = 0;
+}
+
+RTPSocketPool::~RTPSocketPool()
+{
+  close();
+}
+
+bool RTPSocketPool::open(int count, uint16_t port)
+{
+  if (count <= 0) {
+    count = std::thread::hardware_concurrency();
+    if (count <= 0) {
+      count = 1;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mMutex);
+  for (int i = 0; i < count; i++) {
+    std::shared_ptr<RTPSocket> socket = std::make_shared<RTPSocket>();
+    if (!socket->open(port == 0 ? 0 : port + i)) {
+      return false;
+    }
+    mSockets.push_back(socket);
+  }
+  return true;
+}
+
+void RTPSocketPool::close()
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  for (auto socket : mSockets) {
+    socket->close();
+  }
+  mSockets.clear();
+}
+
+std::shared_ptr<RTPSocket> RTPSocketPool::get()
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  if (mSockets.empty()) {
+    return nullptr;
+  }
+  std::shared_ptr<RTPSocket> socket = mSockets[mNextIndex % mSockets.size()];
+  mNextIndex++;
+  return socket;
+}
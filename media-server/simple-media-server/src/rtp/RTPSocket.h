@@ -0,0 +1,88 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "RTPPacer.h"
+#include "../utils/BaseThread.h"
+
+// 受信した RTCP パケットを通知するリスナー
+class RTCPListener {
+public:
+  virtual void onReceivedRtcp(const uint8_t *data, uint32_t len) {}
+};
+
+// 複数の RTPSender で共有する UDP ソケットです。
+// 送信は各 RTPSender から直接行い、受信した RTCP は送信元のアドレス・ポートと SSRC で
+// 振り分けて、登録されている RTCPListener に通知します。
+class RTPSocket : public BaseThread {
+private:
+  int mSocket;
+  uint16_t mPort;
+  std::atomic<bool> mRunning;
+  // このソケットを使用するストリームのペーシングを行うスレッド
+  RTPPacerThread mPacerThread;
+
+  std::mutex mListenerMutex;
+  // 送信元 (ip:port) -> (SSRC -> RTCPListener)
+  std::map<uint64_t, std::map<uint32_t, RTCPListener *>> mListeners;
+  // SSRC -> RTCPListener
+  // NAT などで送信元のアドレスが変わってしまった場合に SSRC だけで振り分けるのに使用します。
+  std::map<uint32_t, RTCPListener *> mSsrcListeners;
+
+  static uint64_t makeKey(const struct sockaddr_in *addr);
+  static void parseSsrcs(const uint8_t *data, uint32_t len, std::vector<uint32_t>& ssrcs);
+  void dispatch(const struct sockaddr_in *from, const uint8_t *data, uint32_t len);
+
+protected:
+  virtual void runThread() override;
+
+public:
+  RTPSocket();
+  virtual ~RTPSocket();
+
+  bool open(uint16_t port);
+  void close();
+
+  int getSocket() {
+    return mSocket;
+  }
+
+  uint16_t getPort() {
+    return mPort;
+  }
+
+  int sendTo(const struct sockaddr_in *dest, const uint8_t *data, uint32_t len);
+
+  void addListener(const struct sockaddr_in *from, uint32_t ssrc, RTCPListener *listener);
+  void removeListener(const struct sockaddr_in *from, uint32_t ssrc);
+
+  void addPacer(RTPPacer *pacer);
+  void removePacer(RTPPacer *pacer);
+};
+
+
+// RTPSocket をまとめて管理します。
+// ソケットは割り当てるたびに順番に使用されます。
+class RTPSocketPool {
+private:
+  std::mutex mMutex;
+  std::vector<std::shared_ptr<RTPSocket>> mSockets;
+  size_t mNextIndex;
+
+public:
+  RTPSocketPool();
+  virtual ~RTPSocketPool();
+
+  // count に 0 を指定した場合には CPU のコア数だけソケットを作成します。
+  // port に 0 を指定した場合には自動でポートを割り当てます。
+  bool open(int count, uint16_t port);
+  void close();
+
+  std::shared_ptr<RTPSocket> get();
+};
@@ -1,13 +1,74 @@
 #include "AAC2OpusConv.h"
+#include "AudioUtils.h"
 #include "Log.h"
+#include <string.h>
 
-#define MAX_DECODE_BUFFER_SIZE (10 * 1024)
-#define OPUS_FRAME_SIZE 960
+// AAC の 1 フレームをデコードした最大のサンプル数 (HE-AAC の 2048 サンプル x 8 チャンネル)
+#define AAC_MAX_DECODE_SIZE (2048 * 8)
+// AAC の 1 フレームの最大のサンプル数 (1 チャンネルあたり)
+#define AAC_MAX_FRAME_SIZE 2048
+// Opus のエンコーダに入力するサンプリング周波数
+// RTP のクロックレートと同じ 48 kHz にします。
+#define OPUS_SAMPLE_RATE 48000
+// PCM のリングバッファに保持する最大の書き込み単位の数
+#define PCM_BUFFER_CHUNKS 4
+// opus_encode の出力バッファとして推奨されているサイズ
+#define OPUS_MAX_PACKET_SIZE 4000
+// Opus の DTX で送信しないフレームのサイズ (TOC のみ)
+#define OPUS_DTX_FRAME_SIZE 2
+// RTMP のタイムスタンプとデコードしたサンプル数のずれがこの値を超えた場合に、
+// 欠落を無音で埋めるか、重複したフレームを捨てます。(ミリ秒)
+#define AUDIO_GAP_THRESHOLD_MS 30
+// ずれがこの値を超えた場合には、埋めずに基準のタイムスタンプを取り直します。(ミリ秒)
+#define AUDIO_GAP_MAX_FILL_MS 1000
+// クロックのずれを補正する PI 制御のゲイン
+// 固有角周波数を 0.05 rad/s (臨界減衰) にして、数分かけてずれに追従させます。
+#define AUDIO_DRIFT_KP 0.1
+#define AUDIO_DRIFT_KI 0.0025
+// RTMP のタイムスタンプの揺らぎを平滑化する時定数 (秒)
+#define AUDIO_DRIFT_SMOOTHING 2.0
+// 補正する変換比の上限 (ppm)
+#define AUDIO_DRIFT_MAX_PPM 1000
+// 補正の状態をログに出力する間隔 (秒)
+#define AUDIO_DRIFT_LOG_INTERVAL 60
+// 再開した直後に送信せずにエンコードする時間 (ミリ秒)
+// AAC のデコーダ (SBR を含む) とエンコーダの先読みの遅延よりも長くします。
+#define AUDIO_WARMUP_MS 60
 
 AAC2OpusConv::AAC2OpusConv()
 {
-  mSampleRate = 48000;
+  mSampleRate = OPUS_SAMPLE_RATE;
   mChannels = 2;
+  mInputSampleRate = OPUS_SAMPLE_RATE;
+  mInputChannels = 2;
+  mOutputChannels = 0;
+  mStreams = 0;
+  mCoupledStreams = 0;
+  mResampling = false;
+  mConverting = false;
+  mDtx = false;
+  mSilenceThresholdDb = -60.0;
+  mHangoverFrames = 10;
+  mKeepAliveFrames = 20;
+  mSilentFrames = 0;
+  mFramesSinceSent = 0;
+  mSuspended = false;
+  mWarmupFrames = 0;
+  mFrameDurationMs = 20;
+  mFramesPerPacket = 1;
+  mFrameSize = 960;
+  mRepacketizer = nullptr;
+  mPendingFrames = 0;
+  mAnchored = false;
+  mAnchorTimestamp = 0;
+  mAnchorPosition = 0;
+  mAnchorId = 0;
+  mReadPosition = 0;
+  mWritePosition = 0;
+  mDriftCompensation = false;
+  mDriftError = 0.0;
+  mDriftIntegral = 0.0;
+  mDriftLogFrames = 0;
 }
 
 AAC2OpusConv::~AAC2OpusConv()
@@ -17,8 +78,16 @@ AAC2OpusConv::~AAC2OpusConv()
 
 void AAC2OpusConv::init(AudioSpecificConfig *config)
 {
+  // 配信が再開されてシーケンスヘッダーを受信し直した場合には、作り直します。
+  destroy();
   initAACRawDecoder(config->rawData.data(), config->rawData.size());
-  initOpusEncoder(config->frequency, config->channelConfiguration);
+  // 明示的に SBR を指定した HE-AAC は、デコーダが SBR の周波数で出力します。
+  // 暗黙的に SBR を使用している場合には、decode で出力の周波数に合わせて変換し直します。
+  uint32_t sampleRate = config->frequency;
+  if (config->extensionAudioObjectType == 5 && config->extensionSamplingFrequency > 0) {
+    sampleRate = config->extensionSamplingFrequency;
+  }
+  initOpusEncoder(sampleRate, AudioChannelMixer::GetChannelCount(config->channelConfiguration));
 }
 
 void AAC2OpusConv::initAACRawDecoder(const uint8_t *ascData, uint32_t ascDataLen)
@@ -28,9 +97,147 @@ void AAC2OpusConv::initAACRawDecoder(const uint8_t *ascData, uint32_t ascDataLen
 
 void AAC2OpusConv::initOpusEncoder(uint32_t sampleRate, uint8_t channels)
 {
-  mSampleRate = sampleRate;
-  mChannels = channels;
-  mEncoder.initialize(sampleRate, channels);
+  // Opus は 44.1 kHz などを扱えないので、エンコーダは常に 48 kHz で初期化します。
+  mSampleRate = OPUS_SAMPLE_RATE;
+  mFrameSize = mSampleRate * mFrameDurationMs / 1000;
+
+  // エンコーダのチャンネル数は、設定されたチャンネル数に合わせて変換します。
+  if (mStreams > 0) {
+    mChannels = mMapping.size();
+    mEncoder.initializeMultistream(mSampleRate, mChannels, mStreams, mCoupledStreams, mMapping.data());
+    if (mFramesPerPacket > 1) {
+      // マルチストリームのパケットは repacketizer でまとめられません。
+      LOG_WARN("Multistream opus does not support multiple frames per packet.\n");
+      mFramesPerPacket = 1;
+    }
+  } else {
+    mChannels = (mOutputChannels > 0) ? mOutputChannels : channels;
+    if (mChannels > 2) {
+      mChannels = 2;
+    }
+    mEncoder.initialize(mSampleRate, mChannels);
+  }
+
+  mDecodeBuf.resize(AAC_MAX_DECODE_SIZE);
+  mSilenceBuf.assign(AAC_MAX_DECODE_SIZE, 0);
+  mMixBuf.resize(AAC_MAX_FRAME_SIZE * AUDIO_MAX_CHANNELS);
+  initMixer(channels);
+
+  initBuffer(initResampler(sampleRate));
+
+  mFrameData.resize(OPUS_MAX_PACKET_SIZE * mFramesPerPacket);
+  mFrameSizes.resize(mFramesPerPacket);
+  mFrameSends.resize(mFramesPerPacket);
+  mFramePositions.resize(mFramesPerPacket);
+  mPendingFrames = 0;
+  if (mFramesPerPacket > 1) {
+    mRepacketizer = opus_repacketizer_create();
+    if (!mRepacketizer) {
+      LOG_ERROR("Failed to create an opus repacketizer.\n");
+    }
+  }
+}
+
+// sampleRate の PCM を 48 kHz に変換するリサンプラーを初期化して、
+// リングバッファの 1 回の書き込み、読み出しに必要なサンプル数を返します。
+uint32_t AAC2OpusConv::initResampler(uint32_t sampleRate)
+{
+  mInputSampleRate = sampleRate;
+
+  // クロックのずれを補正する場合には、48 kHz の場合もリサンプラーで変換比を調整します。
+  mResampling = false;
+  mResampler.reset();
+  uint32_t maxChunk = AAC_MAX_DECODE_SIZE;
+  if (sampleRate != OPUS_SAMPLE_RATE || mDriftCompensation) {
+    if (mResampler.init(sampleRate, OPUS_SAMPLE_RATE, mChannels, mDriftCompensation)) {
+      mResampling = true;
+      uint32_t resampledSize = mResampler.getMaxOutputFrames(AAC_MAX_FRAME_SIZE) * mChannels;
+      if (maxChunk < resampledSize) {
+        maxChunk = resampledSize;
+      }
+    } else {
+      LOG_ERROR("Failed to initialize a resampler. sampleRate=%u\n", sampleRate);
+    }
+  }
+  mConverting = mResampling || !mMixer.isPassthrough();
+
+  // デコーダ (または変換) の出力と、エンコーダの 1 フレームのどちらも連続した領域で扱えるようにします。
+  if (maxChunk < mFrameSize * mChannels) {
+    maxChunk = mFrameSize * mChannels;
+  }
+  return maxChunk;
+}
+
+// 欠落を無音で埋める場合には、エンコードする前に最大で AUDIO_GAP_MAX_FILL_MS 分を書き込むので、
+// エンコードしていない残りと、その後に続くデコード結果と合わせても溢れない大きさを確保します。
+void AAC2OpusConv::initBuffer(uint32_t maxChunk)
+{
+  uint32_t capacity = maxChunk * PCM_BUFFER_CHUNKS;
+  uint32_t fillSize = (uint64_t)AUDIO_GAP_MAX_FILL_MS * OPUS_SAMPLE_RATE / 1000 * mChannels + maxChunk * 2;
+  if (capacity < fillSize) {
+    capacity = fillSize;
+  }
+  mBuf.init(capacity, maxChunk);
+}
+
+void AAC2OpusConv::initMixer(uint8_t channels)
+{
+  mInputChannels = channels;
+  if (!mMixer.init(channels, mChannels)) {
+    // 変換できない場合には、エンコーダのチャンネル数の PCM としてそのまま扱います。
+    mInputChannels = mChannels;
+    mMixer.init(mChannels, mChannels);
+  }
+  mConverting = mResampling || !mMixer.isPassthrough();
+}
+
+void AAC2OpusConv::setChannels(uint8_t channels)
+{
+  mOutputChannels = channels;
+}
+
+void AAC2OpusConv::setMultistream(int streams, int coupledStreams, const std::vector<uint8_t>& mapping)
+{
+  mStreams = streams;
+  mCoupledStreams = coupledStreams;
+  mMapping = mapping;
+}
+
+void AAC2OpusConv::setDriftCompensation(bool enabled)
+{
+  mDriftCompensation = enabled;
+}
+
+void AAC2OpusConv::setFrameDuration(uint32_t durationMs, uint32_t framesPerPacket)
+{
+  mFrameDurationMs = durationMs;
+  mFramesPerPacket = framesPerPacket;
+}
+
+void AAC2OpusConv::setBitrate(uint32_t bitrate)
+{
+  mEncoder.setBitrate(bitrate);
+}
+
+void AAC2OpusConv::setInbandFec(bool enabled)
+{
+  mEncoder.setInbandFec(enabled);
+}
+
+void AAC2OpusConv::setPacketLossPerc(int perc)
+{
+  mEncoder.setPacketLossPerc(perc);
+}
+
+void AAC2OpusConv::setDtx(bool enabled, double thresholdDb, uint32_t hangoverMs, uint32_t keepAliveMs)
+{
+  mDtx = enabled;
+  mSilenceThresholdDb = thresholdDb;
+  mHangoverFrames = hangoverMs / mFrameDurationMs;
+  mKeepAliveFrames = keepAliveMs / mFrameDurationMs;
+  mSilentFrames = 0;
+  mFramesSinceSent = 0;
+  mEncoder.setDtx(enabled);
 }
 
 void AAC2OpusConv::destroy()
@@ -38,32 +245,384 @@ void AAC2OpusConv::destroy()
   mDecoder.destroy();
   mEncoder.destroy();
   mBuf.clear();
+  mResampler.reset();
+  if (mRepacketizer) {
+    opus_repacketizer_destroy(mRepacketizer);
+    mRepacketizer = nullptr;
+  }
+  mPendingFrames = 0;
+  mAnchored = false;
+  mReadPosition = 0;
+  mWritePosition = 0;
+  mDriftError = 0.0;
+  mDriftIntegral = 0.0;
+  mDriftLogFrames = 0;
 }
 
-int32_t AAC2OpusConv::decode(const uint8_t *inBuffer, uint32_t inBufferSize)
+void AAC2OpusConv::suspend()
 {
+  mSuspended = true;
+  flush();
+  mAnchored = false;
+}
+
+void AAC2OpusConv::resume()
+{
+  if (!mSuspended) {
+    return;
+  }
+  mSuspended = false;
+
+  mDecoder.clearHistory();
+  mEncoder.reset();
+  flush();
+  mAnchored = false;
+  mSilentFrames = 0;
+  mFramesSinceSent = 0;
+
+  // 送信しないフレームがパケットの途中で終わらないように、パケットの単位に切り上げます。
+  uint32_t frames = (AUDIO_WARMUP_MS + mFrameDurationMs - 1) / mFrameDurationMs;
+  mWarmupFrames = (frames + mFramesPerPacket - 1) / mFramesPerPacket * mFramesPerPacket;
+}
+
+int32_t AAC2OpusConv::decode(const uint8_t *inBuffer, uint32_t inBufferSize, uint32_t timestamp)
+{
+  if (mSuspended) {
+    return 0;
+  }
+
   if (mDecoder.fillData(inBuffer, inBufferSize) < 0) {
     return -1;
   }
 
-  int16_t decodeBuffer[MAX_DECODE_BUFFER_SIZE];
-  int32_t decodeBufferSize = 0;
-  while ((decodeBufferSize = mDecoder.decode(decodeBuffer, MAX_DECODE_BUFFER_SIZE)) > 0) {
-    mBuf.insert(mBuf.end(), decodeBuffer, decodeBuffer + decodeBufferSize);
+  int32_t decodeSize = 0;
+  while (true) {
+    // 変換しない場合には、デコーダにはリングバッファへ直接書き込ませます。
+    int16_t *pcm = mConverting ? mDecodeBuf.data() : mBuf.getWriteBuffer();
+    uint32_t pcmSize = mConverting ? mDecodeBuf.size() : mBuf.getMaxChunk();
+    if ((decodeSize = mDecoder.decode(pcm, pcmSize)) <= 0) {
+      break;
+    }
+
+    uint8_t channels = mDecoder.getChannels();
+    if (channels != mInputChannels) {
+      // PS などでシーケンスヘッダーとデコード結果のチャンネル数が異なる場合には、変換し直します。
+      LOG_INFO("Change the number of aac channels. %d -> %d\n", mInputChannels, channels);
+      initMixer(channels);
+      if (pcm != mDecodeBuf.data()) {
+        memcpy(mDecodeBuf.data(), pcm, decodeSize * sizeof(int16_t));
+        pcm = mDecodeBuf.data();
+      }
+    }
+    uint32_t sampleRate = mDecoder.getSampleRate();
+    if (sampleRate != 0 && sampleRate != mInputSampleRate) {
+      // HE-AAC の SBR などでシーケンスヘッダーとデコード結果のサンプリング周波数が異なる場合には、変換し直します。
+      LOG_INFO("Change the aac sample rate. %u -> %u\n", mInputSampleRate, sampleRate);
+      if (pcm != mDecodeBuf.data()) {
+        memcpy(mDecodeBuf.data(), pcm, decodeSize * sizeof(int16_t));
+        pcm = mDecodeBuf.data();
+      }
+      uint32_t maxChunk = initResampler(sampleRate);
+      if (maxChunk > mBuf.getMaxChunk()) {
+        flush();
+        initBuffer(maxChunk);
+      }
+    }
+    uint32_t frames = decodeSize / mInputChannels;
+
+    // タイムスタンプと、これまでに書き込んだサンプル数を比べます。
+    int64_t gap = getTimelineGap(timestamp);
+    int64_t threshold = (int64_t)AUDIO_GAP_THRESHOLD_MS * mSampleRate / 1000;
+    int64_t maxFill = (int64_t)AUDIO_GAP_MAX_FILL_MS * mSampleRate / 1000;
+    if (gap < -threshold && gap >= -maxFill) {
+      // 既に送信した時刻と重なるフレームは捨てます。
+      LOG_DEBUG("Drop an overlapping aac frame. gap=%dms\n", (int32_t)(gap * 1000 / mSampleRate));
+      timestamp += frames * 1000 / mInputSampleRate;
+      continue;
+    }
+    if (!mAnchored || gap > threshold || gap < -maxFill) {
+      // 無音を埋めたり、バッファを捨てたりする前に、デコード結果をリングバッファの外に移します。
+      if (pcm != mDecodeBuf.data()) {
+        memcpy(mDecodeBuf.data(), pcm, decodeSize * sizeof(int16_t));
+        pcm = mDecodeBuf.data();
+      }
+      if (!mAnchored) {
+        anchor(timestamp);
+      } else if (gap > maxFill || gap < -maxFill) {
+        // 配信が止まっていた場合などは、埋めずに基準を取り直します。
+        LOG_INFO("Reanchor the audio timeline. gap=%dms\n", (int32_t)(gap * 1000 / mSampleRate));
+        flush();
+        anchor(timestamp);
+      } else if (gap > threshold) {
+        LOG_INFO("Fill an audio gap with silence. gap=%dms\n", (int32_t)(gap * 1000 / mSampleRate));
+        fillSilence(gap * mInputSampleRate / mSampleRate);
+      }
+    } else if (mDriftCompensation && mResampling) {
+      // 欠落や重複ではない小さなずれは、クロックのずれとして変換比で補正します。
+      updateDrift(gap, frames);
+    }
+
+    if (pcm == mDecodeBuf.data()) {
+      convert(pcm, frames);
+    } else {
+      commit(decodeSize);
+    }
+    timestamp += frames * 1000 / mInputSampleRate;
   }
   return 1;
 }
 
-int32_t AAC2OpusConv::encode(uint8_t *outBuffer, uint32_t maxOutBufferSize)
+// RTMP のタイムスタンプから求めたサンプルの位置と、リングバッファに書き込んだサンプルの位置の差を返します。
+// リサンプラーの変換比を調整した分も含めて比べられるように、48 kHz に変換した後の位置を使います。
+int64_t AAC2OpusConv::getTimelineGap(uint32_t timestamp)
+{
+  if (!mAnchored) {
+    return 0;
+  }
+  int64_t expected = mWritePosition - mAnchorPosition;
+  int64_t actual = (int64_t)(int32_t)(timestamp - mAnchorTimestamp) * mSampleRate / 1000;
+  return actual - expected;
+}
+
+// timestamp を次に書き込むサンプルの位置に対応させます。
+void AAC2OpusConv::anchor(uint32_t timestamp)
+{
+  mAnchored = true;
+  mAnchorTimestamp = timestamp;
+  mAnchorPosition = mWritePosition;
+  mAnchorId++;
+  // 変換比 (積分項) はクロックのずれなので、基準を取り直しても引き継ぎます。
+  mDriftError = 0.0;
+}
+
+// 配信側の音声のクロックが RTMP のタイムスタンプに対して速い、または遅い場合には、
+// サンプルの位置とタイムスタンプの差が少しずつ広がっていくので、差が 0 になるように PI 制御で
+// リサンプラーの変換比を調整します。補正の量はクロックのずれ (数十 ppm) 程度なので、音程の変化は聞こえません。
+void AAC2OpusConv::updateDrift(int64_t gap, uint32_t frames)
+{
+  double dt = (double)frames / mInputSampleRate;
+  double error = (double)gap / mSampleRate;
+  // RTMP のタイムスタンプはミリ秒単位で揺らぐので、平滑化してから使います。
+  mDriftError += (error - mDriftError) * (dt / AUDIO_DRIFT_SMOOTHING);
+
+  double maxAdjust = AUDIO_DRIFT_MAX_PPM / 1000000.0;
+  mDriftIntegral += AUDIO_DRIFT_KI * mDriftError * dt;
+  if (mDriftIntegral > maxAdjust) {
+    mDriftIntegral = maxAdjust;
+  } else if (mDriftIntegral < -maxAdjust) {
+    mDriftIntegral = -maxAdjust;
+  }
+
+  double adjust = AUDIO_DRIFT_KP * mDriftError + mDriftIntegral;
+  if (adjust > maxAdjust) {
+    adjust = maxAdjust;
+  } else if (adjust < -maxAdjust) {
+    adjust = -maxAdjust;
+  }
+  mResampler.setRatio(1.0 + adjust);
+
+  mDriftLogFrames += frames;
+  if (mDriftLogFrames >= (uint64_t)AUDIO_DRIFT_LOG_INTERVAL * mInputSampleRate) {
+    mDriftLogFrames = 0;
+    LOG_DEBUG("Audio clock drift. drift=%.1fppm error=%.2fms\n", mDriftIntegral * 1000000.0, mDriftError * 1000.0);
+  }
+}
+
+// 欠落した AAC のサンプル数 (1 チャンネルあたり) の分だけ、無音を書き込みます。
+// 変換の状態が途切れないように、デコード結果と同じ経路を通します。
+void AAC2OpusConv::fillSilence(uint64_t frames)
+{
+  uint32_t maxFrames = mSilenceBuf.size() / mInputChannels;
+  while (frames > 0) {
+    uint32_t n = (frames < maxFrames) ? frames : maxFrames;
+    if (n > AAC_MAX_FRAME_SIZE) {
+      n = AAC_MAX_FRAME_SIZE;
+    }
+    convert(mSilenceBuf.data(), n);
+    frames -= n;
+  }
+}
+
+// 変換途中のサンプルとエンコード済みのフレームを捨てます。
+void AAC2OpusConv::flush()
+{
+  mBuf.clear();
+  mResampler.reset();
+  mPendingFrames = 0;
+  mReadPosition = mWritePosition;
+}
+
+// チャンネル数とサンプリング周波数を変換して、リングバッファに書き込みます。
+void AAC2OpusConv::convert(const int16_t *pcm, uint32_t frames)
+{
+  const int16_t *src = pcm;
+  if (!mMixer.isPassthrough()) {
+    mMixer.process(src, frames, mMixBuf.data());
+    src = mMixBuf.data();
+  }
+
+  if (mResampling) {
+    uint32_t outFrames = mResampler.process(src, frames, mBuf.getWriteBuffer(), mBuf.getMaxChunk() / mChannels);
+    commit(outFrames * mChannels);
+  } else {
+    memcpy(mBuf.getWriteBuffer(), src, frames * mChannels * sizeof(int16_t));
+    commit(frames * mChannels);
+  }
+}
+
+void AAC2OpusConv::commit(uint32_t size)
+{
+  uint32_t dropped = mBuf.commit(size);
+  mWritePosition += size / mChannels;
+  if (dropped > 0) {
+    LOG_WARN("PCM buffer overflow. dropped=%u\n", dropped);
+    mReadPosition += dropped / mChannels;
+  }
+}
+
+int32_t AAC2OpusConv::encode(uint8_t *outBuffer, uint32_t maxOutBufferSize, OpusPacketInfo *info)
 {
-  if (mBuf.size() < (OPUS_FRAME_SIZE * mChannels)) {
+  if (mSuspended) {
     return -1;
   }
 
-  int32_t encodeSize = mEncoder.encode((opus_int16 *)mBuf.data(), OPUS_FRAME_SIZE, outBuffer, maxOutBufferSize);
+  while (mPendingFrames < mFramesPerPacket) {
+    if (encodeFrame() < 0) {
+      return -1;
+    }
+  }
+  info->position = mFramePositions[0];
+  info->anchorTimestamp = mAnchorTimestamp;
+  info->anchorPosition = mAnchorPosition;
+  info->anchorId = mAnchorId;
+  return buildPacket(outBuffer, maxOutBufferSize, info);
+}
+
+// 1 フレーム分をエンコードして、パケットにまとめる前のフレームに追加します。
+int32_t AAC2OpusConv::encodeFrame()
+{
+  if (mBuf.size() < (mFrameSize * mChannels)) {
+    return -1;
+  }
+
+  // 無音の間もエンコーダの状態が途切れないように、エンコードは毎フレーム行います。
+  if (mDtx) {
+    double level = AudioUtils::GetLevelDb(mBuf.getReadBuffer(), mFrameSize * mChannels);
+    if (level < mSilenceThresholdDb) {
+      mSilentFrames++;
+    } else {
+      mSilentFrames = 0;
+    }
+  }
+
+  uint8_t *frame = &mFrameData[mPendingFrames * OPUS_MAX_PACKET_SIZE];
+  int32_t encodeSize = mEncoder.encode((opus_int16 *)mBuf.getReadBuffer(), mFrameSize, frame, OPUS_MAX_PACKET_SIZE);
   if (encodeSize < 0) {
     return -1;
   }
-  mBuf.erase(mBuf.begin(), mBuf.begin() + (OPUS_FRAME_SIZE * mChannels));
+  mBuf.consume(mFrameSize * mChannels);
+
+  mFramePositions[mPendingFrames] = mReadPosition;
+  mReadPosition += mFrameSize;
+  mFrameSizes[mPendingFrames] = encodeSize;
+  if (mWarmupFrames > 0) {
+    // 再開直後のフレームは、エンコーダの状態を作るためだけにエンコードします。
+    mWarmupFrames--;
+    mFrameSends[mPendingFrames] = false;
+  } else {
+    mFrameSends[mPendingFrames] = !isSilent(encodeSize);
+  }
+  mPendingFrames++;
   return encodeSize;
 }
+
+// パケットにまとめる前のフレームを 1 パケットにまとめます。
+int32_t AAC2OpusConv::buildPacket(uint8_t *outBuffer, uint32_t maxOutBufferSize, OpusPacketInfo *info)
+{
+  bool send = false;
+  for (uint32_t i = 0; i < mPendingFrames; i++) {
+    send |= mFrameSends[i];
+  }
+  if (!send) {
+    // 全てのフレームが無音の場合には、パケットごと送信しません。
+    info->frameCount = mPendingFrames;
+    mPendingFrames = 0;
+    return 0;
+  }
+
+  if (mFramesPerPacket == 1 || !mRepacketizer) {
+    info->frameCount = 1;
+    mPendingFrames = 0;
+    if ((uint32_t)mFrameSizes[0] > maxOutBufferSize) {
+      LOG_ERROR("Opus packet is too large. size=%d\n", mFrameSizes[0]);
+      return 0;
+    }
+    memcpy(outBuffer, mFrameData.data(), mFrameSizes[0]);
+    return mFrameSizes[0];
+  }
+
+  // 1 パケットにまとめられるのは、モード、帯域、フレーム長が同じフレームだけなので、
+  // エンコーダがモードを切り替えた場合には、そこでパケットを区切ります。
+  opus_repacketizer_init(mRepacketizer);
+  uint32_t count = 0;
+  for (; count < mPendingFrames; count++) {
+    const uint8_t *frame = &mFrameData[count * OPUS_MAX_PACKET_SIZE];
+    if (opus_repacketizer_cat(mRepacketizer, frame, mFrameSizes[count]) != OPUS_OK) {
+      break;
+    }
+  }
+
+  int32_t packetSize = 0;
+  if (count == 0) {
+    // まとめられないフレームは破棄して、タイムスタンプだけを進めます。
+    LOG_WARN("Failed to repacketize an opus frame. size=%d\n", mFrameSizes[0]);
+    count = 1;
+  } else {
+    packetSize = opus_repacketizer_out(mRepacketizer, outBuffer, maxOutBufferSize);
+    if (packetSize < 0) {
+      LOG_ERROR("Failed to repacketize opus frames: %s\n", opus_strerror(packetSize));
+      packetSize = 0;
+    }
+  }
+
+  // まとめられなかったフレームは、次のパケットの先頭にします。
+  uint32_t remain = mPendingFrames - count;
+  if (remain > 0) {
+    memmove(mFrameData.data(), &mFrameData[count * OPUS_MAX_PACKET_SIZE], remain * OPUS_MAX_PACKET_SIZE);
+    for (uint32_t i = 0; i < remain; i++) {
+      mFrameSizes[i] = mFrameSizes[count + i];
+      mFrameSends[i] = mFrameSends[count + i];
+      mFramePositions[i] = mFramePositions[count + i];
+    }
+  }
+  mPendingFrames = remain;
+  info->frameCount = count;
+  return packetSize;
+}
+
+// 送信しないフレームかを判定します。
+// 話し終わりが途切れないように hangover の間は送信を続け、無音の間も受信側のコンフォートノイズを
+// 更新できるように keepAlive ごとに 1 フレームだけ送信します。
+bool AAC2OpusConv::isSilent(int32_t encodeSize)
+{
+  if (!mDtx) {
+    return false;
+  }
+
+  bool send = false;
+  if (encodeSize <= OPUS_DTX_FRAME_SIZE) {
+    // Opus の DTX が無音と判断したフレームは送信しません。
+    send = false;
+  } else if (mSilentFrames <= mHangoverFrames) {
+    send = true;
+  } else {
+    send = (mKeepAliveFrames > 0 && mFramesSinceSent + 1 >= mKeepAliveFrames);
+  }
+
+  if (send) {
+    mFramesSinceSent = 0;
+  } else {
+    mFramesSinceSent++;
+  }
+  return !send;
+}
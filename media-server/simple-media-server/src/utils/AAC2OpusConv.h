@@ -3,16 +3,114 @@
 #include "../codec/aac/AudioSpecificConfig.h"
 #include "../codec/aac/AACDecoder.h"
 #include "../codec/opus/OpusEncoder.h"
+#include "AudioChannelMixer.h"
+#include "AudioResampler.h"
+#include "RingBuffer.h"
 #include <vector>
 
+// エンコードしたパケットの時刻の情報
+class OpusPacketInfo {
+public:
+  // パケットに含まれるフレーム数
+  uint32_t frameCount = 0;
+  // パケットの先頭のサンプルの位置 (48 kHz のサンプル数)
+  int64_t position = 0;
+  // position の基準になる RTMP のタイムスタンプ (ミリ秒) と、そのサンプルの位置
+  uint32_t anchorTimestamp = 0;
+  int64_t anchorPosition = 0;
+  // 基準を変更するたびに変わる番号
+  uint32_t anchorId = 0;
+};
+
 class AAC2OpusConv {
 private:
   SimpleAACDecoder mDecoder;
   SimpleOpusEncoder mEncoder;
-  std::vector<int16_t> mBuf;
+  // エンコーダに入力する 48 kHz の PCM (インターリーブ)
+  RingBuffer<int16_t> mBuf;
   uint32_t mSampleRate;
   uint8_t mChannels;
 
+  // AAC のサンプリング周波数が 48 kHz 以外の場合や、チャンネル数や並びが異なる場合には、
+  // 変換してからエンコードします。
+  uint32_t mInputSampleRate;
+  uint8_t mInputChannels;
+  bool mResampling;
+  bool mConverting;
+  AudioResampler mResampler;
+  AudioChannelMixer mMixer;
+  std::vector<int16_t> mDecodeBuf;
+  std::vector<int16_t> mMixBuf;
+
+  // RTMP のタイムスタンプとサンプルの位置の対応
+  // サンプルの位置は 48 kHz のサンプル数で、RTP タイムスタンプと同じように進みます。
+  bool mAnchored;
+  uint32_t mAnchorTimestamp;
+  int64_t mAnchorPosition;
+  uint32_t mAnchorId;
+  // リングバッファの読み出し位置と書き込み位置のサンプルの位置
+  int64_t mReadPosition;
+  int64_t mWritePosition;
+  // 欠落を埋める無音
+  std::vector<int16_t> mSilenceBuf;
+
+  // 配信側の音声のクロックのずれを、リサンプラーの変換比で補正するか
+  bool mDriftCompensation;
+  // 平滑化したタイムスタンプとサンプルの位置の差 (秒) と、PI 制御の積分項
+  double mDriftError;
+  double mDriftIntegral;
+  // ログを出力してからのフレーム数
+  uint64_t mDriftLogFrames;
+
+  // 設定されたチャンネル数 (0 の場合は AAC に合わせます)
+  uint8_t mOutputChannels;
+  // マルチストリームの設定 (mStreams が 0 の場合は使用しません)
+  int mStreams;
+  int mCoupledStreams;
+  std::vector<uint8_t> mMapping;
+
+  // フレーム長とパケットにまとめるフレーム数
+  uint32_t mFrameDurationMs;
+  uint32_t mFramesPerPacket;
+  // 1 フレームのサンプル数 (1 チャンネルあたり)
+  uint32_t mFrameSize;
+  OpusRepacketizer *mRepacketizer;
+  // パケットにまとめる前のフレーム
+  std::vector<uint8_t> mFrameData;
+  std::vector<int32_t> mFrameSizes;
+  std::vector<bool> mFrameSends;
+  std::vector<int64_t> mFramePositions;
+  uint32_t mPendingFrames;
+
+  // DTX と無音検出
+  bool mDtx;
+  double mSilenceThresholdDb;
+  uint32_t mHangoverFrames;
+  uint32_t mKeepAliveFrames;
+  // 閾値を下回っているフレームの連続数
+  uint32_t mSilentFrames;
+  // 最後に送信したフレームからのフレーム数
+  uint32_t mFramesSinceSent;
+
+  // 視聴者がいない間は、デコードとエンコードを止めます。
+  bool mSuspended;
+  // 再開した直後に、送信せずにエンコードするフレーム数
+  uint32_t mWarmupFrames;
+
+  bool isSilent(int32_t encodeSize);
+  void commit(uint32_t size);
+  void convert(const int16_t *pcm, uint32_t frames);
+  uint32_t initResampler(uint32_t sampleRate);
+  void initBuffer(uint32_t maxChunk);
+  void initMixer(uint8_t channels);
+  int32_t encodeFrame();
+  int32_t buildPacket(uint8_t *outBuffer, uint32_t maxOutBufferSize, OpusPacketInfo *info);
+  int64_t getTimelineGap(uint32_t timestamp);
+  void updateDrift(int64_t gap, uint32_t frames);
+  void anchor(uint32_t timestamp);
+  void fillSilence(uint64_t frames);
+  void flush();
+
 public:
   AAC2OpusConv();
   virtual ~AAC2OpusConv();
@@ -20,7 +118,39 @@ public:
   void init(AudioSpecificConfig *config);
   void initAACRawDecoder(const uint8_t *ascData, uint32_t ascDataLen);
   void initOpusEncoder(uint32_t sampleRate, uint8_t channels);
-  int32_t decode(const uint8_t *inBuffer, uint32_t inBufferSize);
-  int32_t encode(uint8_t *outBuffer, uint32_t maxOutBufferSize);
+  // Opus エンコーダの設定です。init の前に呼び出しても、初期化時に反映されます。
+  void setBitrate(uint32_t bitrate);
+  void setInbandFec(bool enabled);
+  void setPacketLossPerc(int perc);
+  // DTX を設定します。有効な場合には、レベルが thresholdDb (dBFS) を下回った状態が
+  // hangoverMs 続いたら、keepAliveMs ごとのパケットを除いて送信を止めます。
+  void setDtx(bool enabled, double thresholdDb, uint32_t hangoverMs, uint32_t keepAliveMs);
+  // フレーム長 (10, 20, 40, 60 ミリ秒) と 1 パケットにまとめるフレーム数を設定します。
+  // init の前に呼び出してください。
+  void setFrameDuration(uint32_t durationMs, uint32_t framesPerPacket);
+  // エンコーダのチャンネル数 (1 または 2) を設定します。init の前に呼び出してください。
+  void setChannels(uint8_t channels);
+  // マルチストリームでエンコードする場合に、RFC 7845 のチャンネルマッピングを設定します。
+  // mapping の要素数がチャンネル数になります。init の前に呼び出してください。
+  void setMultistream(int streams, int coupledStreams, const std::vector<uint8_t>& mapping);
+  // RTMP のタイムスタンプに対する配信側の音声のクロックのずれを、変換比を少しずつ変えて補正するかを設定します。
+  // 有効な場合には、48 kHz の AAC もリサンプラーを通します。init の前に呼び出してください。
+  void setDriftCompensation(bool enabled);
+  // timestamp には AAC のフレームの RTMP のタイムスタンプ (ミリ秒) を指定します。
+  // デコードしたサンプル数とタイムスタンプがずれている場合には、欠落を無音で埋めるか、重複したフレームを捨てます。
+  int32_t decode(const uint8_t *inBuffer, uint32_t inBufferSize, uint32_t timestamp);
+  // 1 パケット分をエンコードして、そのサイズを返します。info にはパケットの時刻とフレーム数が入ります。
+  // フレームの設定が変わってまとめられない場合には、frameCount は framesPerPacket より少なくなります。
+  // DTX で送信しないパケットの場合には 0 を、PCM が足りない場合には -1 を返します。
+  int32_t encode(uint8_t *outBuffer, uint32_t maxOutBufferSize, OpusPacketInfo *info);
+  // デコードとエンコードを止めます。止めている間に decode に渡した AAC は捨てます。
+  void suspend();
+  // デコードとエンコードを再開します。
+  // 止める前の状態が混ざらないようにデコーダとエンコーダを初期化して、エンコーダの状態が落ち着くまでの
+  // 最初のパケットは送信しないパケット (encode が 0 を返す) にします。
+  void resume();
+  bool isSuspended() const {
+    return mSuspended;
+  }
   void destroy();
 };
@@ -0,0 +1,280 @@
+#include <string.h>
+#include "AudioChannelMixer.h"
+#include "Log.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// -3 dB
+#define AUDIO_MIX_GAIN_3DB 0.70710678f
+
+// fdk-aac が出力するチャンネルの並び (WAV)
+static const AudioChannelPosition kWavLayouts[AUDIO_MAX_CHANNELS][AUDIO_MAX_CHANNELS] = {
+  { AudioChannelFrontCenter },
+  { AudioChannelFrontLeft, AudioChannelFrontRight },
+  { AudioChannelFrontLeft, AudioChannelFrontRight, AudioChannelFrontCenter },
+  { AudioChannelFrontLeft, AudioChannelFrontRight, AudioChannelFrontCenter, AudioChannelBackCenter },
+  { AudioChannelFrontLeft, AudioChannelFrontRight, AudioChannelFrontCenter, AudioChannelBackLeft, AudioChannelBackRight },
+  { AudioChannelFrontLeft, AudioChannelFrontRight, AudioChannelFrontCenter, AudioChannelLowFrequency,
+    AudioChannelBackLeft, AudioChannelBackRight },
+  { AudioChannelFrontLeft, AudioChannelFrontRight, AudioChannelFrontCenter, AudioChannelLowFrequency,
+    AudioChannelBackLeft, AudioChannelBackRight, AudioChannelBackCenter },
+  { AudioChannelFrontLeft, AudioChannelFrontRight, AudioChannelFrontCenter, AudioChannelLowFrequency,
+    AudioChannelBackLeft, AudioChannelBackRight, AudioChannelSideLeft, AudioChannelSideRight },
+};
+
+// Opus のチャンネルの並び (Vorbis)
+// see https://www.rfc-editor.org/rfc/rfc7845#section-5.1.1.2
+static const AudioChannelPosition kVorbisLayouts[AUDIO_MAX_CHANNELS][AUDIO_MAX_CHANNELS] = {
+  { AudioChannelFrontCenter },
+  { AudioChannelFrontLeft, AudioChannelFrontRight },
+  { AudioChannelFrontLeft, AudioChannelFrontCenter, AudioChannelFrontRight },
+  { AudioChannelFrontLeft, AudioChannelFrontRight, AudioChannelBackLeft, AudioChannelBackRight },
+  { AudioChannelFrontLeft, AudioChannelFrontCenter, AudioChannelFrontRight, AudioChannelBackLeft, AudioChannelBackRight },
+  { AudioChannelFrontLeft, AudioChannelFrontCenter, AudioChannelFrontRight, AudioChannelBackLeft, AudioChannelBackRight,
+    AudioChannelLowFrequency },
+  { AudioChannelFrontLeft, AudioChannelFrontCenter, AudioChannelFrontRight, AudioChannelSideLeft, AudioChannelSideRight,
+    AudioChannelBackCenter, AudioChannelLowFrequency },
+  { AudioChannelFrontLeft, AudioChannelFrontCenter, AudioChannelFrontRight, AudioChannelSideLeft, AudioChannelSideRight,
+    AudioChannelBackLeft, AudioChannelBackRight, AudioChannelLowFrequency },
+};
+
+static int findPosition(const AudioChannelPosition *layout, uint8_t channels, AudioChannelPosition position)
+{
+  for (uint8_t i = 0; i < channels; i++) {
+    if (layout[i] == position) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+AudioChannelMixer::AudioChannelMixer()
+{
+  mInChannels = 0;
+  mOutChannels = 0;
+  mPassthrough = true;
+}
+
+AudioChannelMixer::~AudioChannelMixer()
+{
+}
+
+uint8_t AudioChannelMixer::GetChannelCount(uint8_t channelConfiguration)
+{
+  switch (channelConfiguration) {
+  case 1:
+  case 2:
+  case 3:
+  case 4:
+  case 5:
+  case 6:
+    return channelConfiguration;
+  case 7:
+    return 8;
+  default:
+    // PCE で指定されている場合などは、デコードするまで分からないのでステレオとしておきます。
+    return 2;
+  }
+}
+
+bool AudioChannelMixer::init(uint8_t inChannels, uint8_t outChannels)
+{
+  if (inChannels == 0 || inChannels > AUDIO_MAX_CHANNELS || outChannels == 0 || outChannels > AUDIO_MAX_CHANNELS) {
+    LOG_ERROR("Unsupported channels. in=%d out=%d\n", inChannels, outChannels);
+    return false;
+  }
+
+  mInChannels = inChannels;
+  mOutChannels = outChannels;
+
+  // 行列 (出力チャンネル x 入力チャンネル) を作ります。
+  const AudioChannelPosition *inLayout = kWavLayouts[inChannels - 1];
+  const AudioChannelPosition *outLayout = kVorbisLayouts[outChannels - 1];
+  float matrix[AUDIO_MAX_CHANNELS * AUDIO_MAX_CHANNELS] = { 0 };
+  for (uint8_t i = 0; i < inChannels; i++) {
+    if (inChannels == 1) {
+      // モノラルは全ての前方のチャンネルにそのままコピーします。
+      int left = findPosition(outLayout, mOutChannels, AudioChannelFrontLeft);
+      int right = findPosition(outLayout, mOutChannels, AudioChannelFrontRight);
+      if (left >= 0 && right >= 0) {
+        matrix[left * AUDIO_MAX_CHANNELS + i] = 1.0f;
+        matrix[right * AUDIO_MAX_CHANNELS + i] = 1.0f;
+        continue;
+      }
+    }
+    addPosition(matrix, outLayout, inLayout[i], i, 1.0f);
+  }
+
+  // ゲインの合計が 1 を超える出力チャンネルは正規化します。
+  for (uint8_t o = 0; o < outChannels; o++) {
+    float sum = 0.0f;
+    for (uint8_t i = 0; i < inChannels; i++) {
+      sum += matrix[o * AUDIO_MAX_CHANNELS + i];
+    }
+    if (sum > 1.0f) {
+      for (uint8_t i = 0; i < inChannels; i++) {
+        matrix[o * AUDIO_MAX_CHANNELS + i] /= sum;
+      }
+    }
+  }
+
+  // 入力チャンネルごとの列にして、恒等変換かを判定します。
+  mColumns.assign(inChannels * AUDIO_MAX_CHANNELS, 0.0f);
+  mPassthrough = (inChannels == outChannels);
+  for (uint8_t i = 0; i < inChannels; i++) {
+    for (uint8_t o = 0; o < outChannels; o++) {
+      float gain = matrix[o * AUDIO_MAX_CHANNELS + i];
+      mColumns[i * AUDIO_MAX_CHANNELS + o] = gain;
+      if (gain != ((i == o) ? 1.0f : 0.0f)) {
+        mPassthrough = false;
+      }
+    }
+  }
+
+  LOG_INFO("Initialized channel mixer. in=%d out=%d passthrough=%s\n", inChannels, outChannels, mPassthrough ? "true" : "false");
+  return true;
+}
+
+// 入力チャンネルを出力の同じ位置に足し込みます。出力にない位置の場合には、近くの位置に分配します。
+void AudioChannelMixer::addPosition(float *matrix, const AudioChannelPosition *outLayout, AudioChannelPosition position, uint8_t inIndex, float gain)
+{
+  int o = findPosition(outLayout, mOutChannels, position);
+  if (o >= 0) {
+    matrix[o * AUDIO_MAX_CHANNELS + inIndex] += gain;
+    return;
+  }
+
+  // 出力には必ず FC か FL/FR のどちらかがあるので、分配は循環しません。
+  switch (position) {
+  case AudioChannelFrontLeft:
+  case AudioChannelFrontRight:
+    addPosition(matrix, outLayout, AudioChannelFrontCenter, inIndex, gain * AUDIO_MIX_GAIN_3DB);
+    break;
+  case AudioChannelFrontCenter:
+    addPosition(matrix, outLayout, AudioChannelFrontLeft, inIndex, gain * AUDIO_MIX_GAIN_3DB);
+    addPosition(matrix, outLayout, AudioChannelFrontRight, inIndex, gain * AUDIO_MIX_GAIN_3DB);
+    break;
+  case AudioChannelBackLeft:
+    if (findPosition(outLayout, mOutChannels, AudioChannelSideLeft) >= 0) {
+      addPosition(matrix, outLayout, AudioChannelSideLeft, inIndex, gain);
+    } else {
+      addPosition(matrix, outLayout, AudioChannelFrontLeft, inIndex, gain * AUDIO_MIX_GAIN_3DB);
+    }
+    break;
+  case AudioChannelBackRight:
+    if (findPosition(outLayout, mOutChannels, AudioChannelSideRight) >= 0) {
+      addPosition(matrix, outLayout, AudioChannelSideRight, inIndex, gain);
+    } else {
+      addPosition(matrix, outLayout, AudioChannelFrontRight, inIndex, gain * AUDIO_MIX_GAIN_3DB);
+    }
+    break;
+  case AudioChannelSideLeft:
+    if (findPosition(outLayout, mOutChannels, AudioChannelBackLeft) >= 0) {
+      addPosition(matrix, outLayout, AudioChannelBackLeft, inIndex, gain);
+    } else {
+      addPosition(matrix, outLayout, AudioChannelFrontLeft, inIndex, gain * AUDIO_MIX_GAIN_3DB);
+    }
+    break;
+  case AudioChannelSideRight:
+    if (findPosition(outLayout, mOutChannels, AudioChannelBackRight) >= 0) {
+      addPosition(matrix, outLayout, AudioChannelBackRight, inIndex, gain);
+    } else {
+      addPosition(matrix, outLayout, AudioChannelFrontRight, inIndex, gain * AUDIO_MIX_GAIN_3DB);
+    }
+    break;
+  case AudioChannelBackCenter:
+    addPosition(matrix, outLayout, AudioChannelBackLeft, inIndex, gain * AUDIO_MIX_GAIN_3DB);
+    addPosition(matrix, outLayout, AudioChannelBackRight, inIndex, gain * AUDIO_MIX_GAIN_3DB);
+    break;
+  case AudioChannelLowFrequency:
+    // LFE は出力にない場合には捨てます。
+    break;
+  }
+}
+
+void AudioChannelMixer::process(const int16_t *in, uint32_t frames, int16_t *out)
+{
+  if (mPassthrough) {
+    memcpy(out, in, frames * mInChannels * sizeof(int16_t));
+    return;
+  }
+
+  if (mInChannels == 1 && mOutChannels == 2) {
+    processUpmixMono(in, frames, out);
+    return;
+  }
+
+  const float *columns = mColumns.data();
+  for (uint32_t f = 0; f < frames; f++) {
+    const int16_t *src = &in[f * mInChannels];
+    int16_t *dst = &out[f * mOutChannels];
+    int16_t mixed[AUDIO_MAX_CHANNELS];
+
+#if defined(__SSE2__)
+    // 入力の 1 サンプルを出力チャンネル分の係数にまとめて掛けます。
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    for (uint8_t i = 0; i < mInChannels; i++) {
+      __m128 s = _mm_set1_ps((float)src[i]);
+      const float *column = &columns[i * AUDIO_MAX_CHANNELS];
+      acc0 = _mm_add_ps(acc0, _mm_mul_ps(s, _mm_loadu_ps(column)));
+      acc1 = _mm_add_ps(acc1, _mm_mul_ps(s, _mm_loadu_ps(column + 4)));
+    }
+    // 丸めて、飽和させながら 16 bit にします。
+    __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(acc0), _mm_cvtps_epi32(acc1));
+    _mm_storeu_si128((__m128i *)mixed, packed);
+#elif defined(__ARM_NEON)
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    for (uint8_t i = 0; i < mInChannels; i++) {
+      const float *column = &columns[i * AUDIO_MAX_CHANNELS];
+      acc0 = vmlaq_n_f32(acc0, vld1q_f32(column), (float)src[i]);
+      acc1 = vmlaq_n_f32(acc1, vld1q_f32(column + 4), (float)src[i]);
+    }
+#if defined(__aarch64__)
+    int16x8_t packed = vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(acc0)), vqmovn_s32(vcvtnq_s32_f32(acc1)));
+#else
+    int16x8_t packed = vcombine_s16(vqmovn_s32(vcvtq_s32_f32(acc0)), vqmovn_s32(vcvtq_s32_f32(acc1)));
+#endif
+    vst1q_s16(mixed, packed);
+#else
+    for (uint8_t o = 0; o < mOutChannels; o++) {
+      float sum = 0.0f;
+      for (uint8_t i = 0; i < mInChannels; i++) {
+        sum += src[i] * columns[i * AUDIO_MAX_CHANNELS + o];
+      }
+      sum = (sum > 0.0f) ? sum + 0.5f : sum - 0.5f;
+      mixed[o] = (sum >= 32767.0f) ? 32767 : (sum <= -32768.0f) ? -32768 : (int16_t)sum;
+    }
+#endif
+
+    memcpy(dst, mixed, mOutChannels * sizeof(int16_t));
+  }
+}
+
+// モノラルを左右にコピーします。
+void AudioChannelMixer::processUpmixMono(const int16_t *in, uint32_t frames, int16_t *out)
+{
+  uint32_t f = 0;
+#if defined(__SSE2__)
+  for (; f + 8 <= frames; f += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)&in[f]);
+    _mm_storeu_si128((__m128i *)&out[f * 2], _mm_unpacklo_epi16(v, v));
+    _mm_storeu_si128((__m128i *)&out[f * 2 + 8], _mm_unpackhi_epi16(v, v));
+  }
+#elif defined(__ARM_NEON)
+  for (; f + 8 <= frames; f += 8) {
+    int16x8_t v = vld1q_s16(&in[f]);
+    int16x8x2_t lr = { { v, v } };
+    vst2q_s16(&out[f * 2], lr);
+  }
+#endif
+  for (; f < frames; f++) {
+    out[f * 2] = in[f];
+    out[f * 2 + 1] = in[f];
+  }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+// チャンネルの最大数
+#define AUDIO_MAX_CHANNELS 8
+
+// スピーカーの位置
+typedef enum {
+  AudioChannelFrontLeft,
+  AudioChannelFrontRight,
+  AudioChannelFrontCenter,
+  AudioChannelLowFrequency,
+  AudioChannelBackLeft,
+  AudioChannelBackRight,
+  AudioChannelSideLeft,
+  AudioChannelSideRight,
+  AudioChannelBackCenter
+} AudioChannelPosition;
+
+// インターリーブされた PCM のチャンネル数と並びを変換します。
+//
+// 入力は fdk-aac が出力する WAV の並び、出力は Opus (RFC 7845 のチャンネルマッピング 0, 1) の
+// Vorbis の並びです。出力にないチャンネルは ITU-R BS.775 の係数で近くのチャンネルに混ぜて、
+// 合計のゲインが 1 を超える出力チャンネルは、クリップしないように正規化します。
+//
+// 変換は入力チャンネルごとに、出力チャンネル分の係数 (行列の列) をまとめて掛けて足し込みます。
+class AudioChannelMixer {
+private:
+  uint8_t mInChannels;
+  uint8_t mOutChannels;
+  bool mPassthrough;
+  // 入力チャンネルごとの係数 (AUDIO_MAX_CHANNELS 個ずつ)
+  std::vector<float> mColumns;
+
+  void addPosition(float *matrix, const AudioChannelPosition *outLayout, AudioChannelPosition position, uint8_t inIndex, float gain);
+  void processUpmixMono(const int16_t *in, uint32_t frames, int16_t *out);
+
+public:
+  AudioChannelMixer();
+  virtual ~AudioChannelMixer();
+
+  // 対応していないチャンネル数の場合には false を返します。
+  bool init(uint8_t inChannels, uint8_t outChannels);
+
+  // 変換が不要な場合には true を返します。
+  bool isPassthrough() const {
+    return mPassthrough;
+  }
+
+  // frames 分の PCM を変換します。out には frames * outChannels 分の領域が必要です。
+  void process(const int16_t *in, uint32_t frames, int16_t *out);
+
+  // AAC の channelConfiguration からチャンネル数を返します。
+  static uint8_t GetChannelCount(uint8_t channelConfiguration);
+};
@@ -0,0 +1,265 @@
+#include <math.h>
+#include <string.h>
+#include "AudioResampler.h"
+#include "AudioUtils.h"
+#include "Log.h"
+
+// 1 位相あたりのタップ数 (SIMD で割り切れるように 8 の倍数にします)
+#define RESAMPLER_TAPS 64
+// 係数のテーブルが大きくなりすぎないように、位相の数を制限します。
+#define RESAMPLER_MAX_PHASES 1024
+// 低い方のナイキスト周波数に対するカットオフ周波数の比
+#define RESAMPLER_CUTOFF 0.91
+// カイザー窓のパラメータ (阻止域の減衰量は約 80 dB)
+#define RESAMPLER_KAISER_BETA 7.857
+// 変換比を調整する場合の位相の数 (位相の間は線形補間します)
+#define RESAMPLER_ADAPTIVE_PHASES 256
+// 変換比の調整の上限
+#define RESAMPLER_MAX_RATIO_ADJUST 0.01
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+  while (b != 0) {
+    uint32_t t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+// 第 1 種変形ベッセル関数 (0 次)
+static double besselI0(double x)
+{
+  double sum = 1.0;
+  double term = 1.0;
+  for (int k = 1; k < 50; k++) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+    if (term < sum * 1e-12) {
+      break;
+    }
+  }
+  return sum;
+}
+
+static inline int16_t toInt16(float v)
+{
+  float s = v * 32768.0f;
+  if (s >= 32767.0f) {
+    return 32767;
+  } else if (s <= -32768.0f) {
+    return -32768;
+  }
+  return (int16_t)lrintf(s);
+}
+
+AudioResampler::AudioResampler()
+{
+  mInRate = 0;
+  mOutRate = 0;
+  mChannels = 0;
+  mUpFactor = 1;
+  mDownFactor = 1;
+  mTaps = RESAMPLER_TAPS;
+  mInputSize = 0;
+  mPhase = 0;
+  mAdaptive = false;
+  mRatio = 1.0;
+  mStep = 1.0;
+  mFracPhase = 0.0;
+}
+
+AudioResampler::~AudioResampler()
+{
+}
+
+bool AudioResampler::init(uint32_t inRate, uint32_t outRate, uint8_t channels, bool adaptive)
+{
+  if (inRate == 0 || outRate == 0 || channels == 0) {
+    LOG_ERROR("Invalid resampler parameters. inRate=%u outRate=%u channels=%d\n", inRate, outRate, channels);
+    return false;
+  }
+
+  uint32_t g = gcd(inRate, outRate);
+  if (!adaptive && outRate / g > RESAMPLER_MAX_PHASES) {
+    LOG_ERROR("Unsupported resampling ratio. inRate=%u outRate=%u\n", inRate, outRate);
+    return false;
+  }
+
+  mInRate = inRate;
+  mOutRate = outRate;
+  mChannels = channels;
+  mAdaptive = adaptive;
+  if (adaptive) {
+    // 変換比が既約分数にならないので、位相の数は固定にします。
+    mUpFactor = RESAMPLER_ADAPTIVE_PHASES;
+    mDownFactor = 1;
+  } else {
+    mUpFactor = outRate / g;
+    mDownFactor = inRate / g;
+  }
+  makeCoefs();
+  reset();
+  setRatio(1.0);
+
+  LOG_INFO("Initialized resampler. inRate=%u outRate=%u channels=%d phases=%u adaptive=%s\n",
+      inRate, outRate, channels, mUpFactor, adaptive ? "true" : "false");
+  return true;
+}
+
+void AudioResampler::reset()
+{
+  // フィルタの遅延の分だけ 0 を入れておき、出力の先頭が入力の先頭に揃うようにします。
+  mInputs.assign(mChannels, std::vector<float>(mTaps, 0.0f));
+  mInputSize = mTaps / 2 - 1;
+  mPhase = 0;
+  mFracPhase = 0.0;
+}
+
+void AudioResampler::setRatio(double ratio)
+{
+  if (!mAdaptive) {
+    return;
+  }
+  if (ratio > 1.0 + RESAMPLER_MAX_RATIO_ADJUST) {
+    ratio = 1.0 + RESAMPLER_MAX_RATIO_ADJUST;
+  } else if (ratio < 1.0 - RESAMPLER_MAX_RATIO_ADJUST) {
+    ratio = 1.0 - RESAMPLER_MAX_RATIO_ADJUST;
+  }
+  mRatio = ratio;
+  // 1 出力あたりに進める入力のサンプル数を、位相の単位にします。
+  mStep = (double)mUpFactor * mInRate / (mOutRate * ratio);
+}
+
+void AudioResampler::makeCoefs()
+{
+  // adaptive の場合には、位相 L-1 と次の入力の位相 0 の間も補間できるように、位相 L の係数も作成します。
+  uint32_t phases = mAdaptive ? mUpFactor + 1 : mUpFactor;
+  uint32_t length = mUpFactor * mTaps + 1;
+  // アップサンプリング後の周波数で正規化したカットオフ周波数
+  double minRate = (mInRate < mOutRate) ? mInRate : mOutRate;
+  double cutoff = 0.5 * minRate * RESAMPLER_CUTOFF / ((double)mInRate * mUpFactor);
+  // 遅延が入力の整数サンプル (mTaps / 2) になるように、中心を位相 0 に合わせます。
+  double center = (double)(mTaps / 2) * mUpFactor;
+  double i0Beta = besselI0(RESAMPLER_KAISER_BETA);
+
+  std::vector<double> h(length);
+  for (uint32_t k = 0; k < length; k++) {
+    double t = k - center;
+    double x = 2.0 * cutoff * t;
+    double sinc = (x == 0.0) ? 1.0 : sin(M_PI * x) / (M_PI * x);
+    double r = t / center;
+    double window = (r >= 1.0) ? 0.0 : besselI0(RESAMPLER_KAISER_BETA * sqrt(1.0 - r * r)) / i0Beta;
+    h[k] = 2.0 * cutoff * sinc * window;
+  }
+
+  // 位相 p の出力は、入力 x[i - j] に係数 h[j * L + p] をかけた和になります。
+  // 窓の先頭から順に掛けられるように反転して、位相ごとに直流のゲインを 1 に揃えます。
+  mCoefs.resize(phases * mTaps);
+  for (uint32_t p = 0; p < phases; p++) {
+    double sum = 0.0;
+    for (uint32_t t = 0; t < mTaps; t++) {
+      sum += h[(mTaps - 1 - t) * mUpFactor + p];
+    }
+    for (uint32_t t = 0; t < mTaps; t++) {
+      mCoefs[p * mTaps + t] = (float)(h[(mTaps - 1 - t) * mUpFactor + p] / sum);
+    }
+  }
+}
+
+uint32_t AudioResampler::getMaxOutputFrames(uint32_t inFrames) const
+{
+  if (mAdaptive) {
+    double ratio = 1.0 + RESAMPLER_MAX_RATIO_ADJUST;
+    return (uint32_t)((double)(inFrames + mTaps) * mOutRate * ratio / mInRate) + 1;
+  }
+  return (uint32_t)(((uint64_t)(inFrames + mTaps) * mUpFactor) / mDownFactor) + 1;
+}
+
+uint32_t AudioResampler::process(const int16_t *in, uint32_t inFrames, int16_t *out, uint32_t maxOutFrames)
+{
+  if (mChannels == 0) {
+    return 0;
+  }
+
+  // チャンネルごとに float にして、窓の後ろに追加します。
+  uint32_t inputSize = mInputSize + inFrames;
+  for (uint8_t c = 0; c < mChannels; c++) {
+    std::vector<float>& input = mInputs[c];
+    if (input.size() < inputSize) {
+      input.resize(inputSize);
+    }
+    float *dst = &input[mInputSize];
+    for (uint32_t i = 0; i < inFrames; i++) {
+      dst[i] = in[i * mChannels + c] * (1.0f / 32768.0f);
+    }
+  }
+  mInputSize = inputSize;
+
+  uint32_t pos = 0;
+  uint32_t outFrames = mAdaptive ? processAdaptive(out, maxOutFrames, &pos) : processFixed(out, maxOutFrames, &pos);
+
+  // 使い終わった入力を捨てて、窓の先頭を詰めます。
+  if (pos > 0) {
+    uint32_t remain = (pos < mInputSize) ? mInputSize - pos : 0;
+    for (uint8_t c = 0; c < mChannels; c++) {
+      if (remain > 0) {
+        memmove(mInputs[c].data(), &mInputs[c][pos], remain * sizeof(float));
+      }
+    }
+    mInputSize = remain;
+  }
+  return outFrames;
+}
+
+// 変換比が固定の場合には、整数の位相だけで計算します。
+uint32_t AudioResampler::processFixed(int16_t *out, uint32_t maxOutFrames, uint32_t *consumed)
+{
+  uint32_t pos = 0;
+  uint32_t phase = mPhase;
+  uint32_t outFrames = 0;
+  while (pos + mTaps <= mInputSize && outFrames < maxOutFrames) {
+    const float *coef = &mCoefs[phase * mTaps];
+    for (uint8_t c = 0; c < mChannels; c++) {
+      out[outFrames * mChannels + c] = toInt16(AudioUtils::DotProduct(&mInputs[c][pos], coef, mTaps));
+    }
+    outFrames++;
+
+    phase += mDownFactor;
+    pos += phase / mUpFactor;
+    phase %= mUpFactor;
+  }
+  mPhase = phase;
+  *consumed = pos;
+  return outFrames;
+}
+
+// 変換比を調整する場合には、出力の位置を挟む 2 つの位相で畳み込んで、その間を線形補間します。
+// 係数を補間してから畳み込むのと同じ結果になります。
+uint32_t AudioResampler::processAdaptive(int16_t *out, uint32_t maxOutFrames, uint32_t *consumed)
+{
+  uint32_t pos = 0;
+  double phase = mFracPhase;
+  uint32_t outFrames = 0;
+  while (pos + mTaps <= mInputSize && outFrames < maxOutFrames) {
+    uint32_t p = (uint32_t)phase;
+    float frac = (float)(phase - p);
+    const float *coef0 = &mCoefs[p * mTaps];
+    const float *coef1 = coef0 + mTaps;
+    for (uint8_t c = 0; c < mChannels; c++) {
+      const float *input = &mInputs[c][pos];
+      float v0 = AudioUtils::DotProduct(input, coef0, mTaps);
+      float v1 = AudioUtils::DotProduct(input, coef1, mTaps);
+      out[outFrames * mChannels + c] = toInt16(v0 + (v1 - v0) * frac);
+    }
+    outFrames++;
+
+    phase += mStep;
+    uint32_t advance = (uint32_t)(phase / mUpFactor);
+    pos += advance;
+    phase -= (double)advance * mUpFactor;
+  }
+  mFracPhase = phase;
+  *consumed = pos;
+  return outFrames;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+// ポリフェーズ FIR フィルタによるサンプリング周波数の変換です。
+//
+// 入力と出力のサンプリング周波数の比を L/M (既約分数) として、L 倍にアップサンプリングして
+// ローパスフィルタをかけた後に 1/M にダウンサンプリングする処理を、必要な位相の係数だけを
+// 使って計算します。係数はカイザー窓をかけた sinc 関数です。
+//
+// チャンネルごとに float で入力を保持して、フィルタの畳み込みは AudioUtils::DotProduct で行います。
+//
+// adaptive で初期化した場合には、変換比を setRatio で少しずつ変えられるようにします。
+// 係数は固定の位相数で作成して、出力の位置に応じて隣り合う 2 つの位相の間を線形補間します。
+class AudioResampler {
+private:
+  uint32_t mInRate;
+  uint32_t mOutRate;
+  uint8_t mChannels;
+  // アップサンプリングとダウンサンプリングの比 (L/M)
+  uint32_t mUpFactor;
+  uint32_t mDownFactor;
+  // 1 位相あたりのタップ数
+  uint32_t mTaps;
+  // 位相ごとの係数 (畳み込みで順方向に使えるように反転して格納しています)
+  std::vector<float> mCoefs;
+  // チャンネルごとの入力 (フィルタの窓の先頭から)
+  std::vector<std::vector<float>> mInputs;
+  uint32_t mInputSize;
+  // 次に出力するサンプルの位相
+  uint32_t mPhase;
+
+  // 変換比を調整できるか
+  bool mAdaptive;
+  // 変換比の調整 (出力のサンプリング周波数に掛ける比)
+  double mRatio;
+  // adaptive の場合の 1 出力あたりに進める位相と、次に出力するサンプルの位相
+  double mStep;
+  double mFracPhase;
+
+  void makeCoefs();
+  uint32_t processFixed(int16_t *out, uint32_t maxOutFrames, uint32_t *consumed);
+  uint32_t processAdaptive(int16_t *out, uint32_t maxOutFrames, uint32_t *consumed);
+
+public:
+  AudioResampler();
+  virtual ~AudioResampler();
+
+  // 変換できない周波数の組み合わせの場合には false を返します。
+  // adaptive が true の場合には、setRatio で変換比を調整できます。
+  bool init(uint32_t inRate, uint32_t outRate, uint8_t channels, bool adaptive = false);
+  void reset();
+
+  // 出力のサンプリング周波数を outRate * ratio として変換します。adaptive の場合にだけ有効です。
+  // ratio は 0.99 から 1.01 の範囲に制限します。
+  void setRatio(double ratio);
+  double getRatio() const {
+    return mRatio;
+  }
+
+  // inFrames の入力から出力される最大のフレーム数を返します。
+  uint32_t getMaxOutputFrames(uint32_t inFrames) const;
+
+  // インターリーブされた PCM を変換して、出力したフレーム数を返します。
+  uint32_t process(const int16_t *in, uint32_t inFrames, int16_t *out, uint32_t maxOutFrames);
+};
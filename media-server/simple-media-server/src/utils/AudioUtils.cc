@@ -0,0 +1,111 @@
+#include <math.h>
+#include "AudioUtils.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// 無音とみなすレベル (dBFS)
+#define AUDIO_LEVEL_MIN_DB -100.0
+
+uint64_t AudioUtils::SumOfSquares(const int16_t *samples, size_t count)
+{
+  uint64_t sum = 0;
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  // _mm_madd_epi16 は隣り合う 2 サンプルの二乗和を 32 bit で返します。
+  // -32768 が 2 つ並ぶと符号付きでは溢れるので、符号無しとして 64 bit に広げて足し込みます。
+  __m128i zero = _mm_setzero_si128();
+  __m128i acc = _mm_setzero_si128();
+  for (; i + 8 <= count; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)&samples[i]);
+    __m128i sq = _mm_madd_epi16(v, v);
+    acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(sq, zero));
+    acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(sq, zero));
+  }
+  uint64_t lanes[2];
+  _mm_storeu_si128((__m128i *)lanes, acc);
+  sum = lanes[0] + lanes[1];
+#elif defined(__ARM_NEON)
+  uint64x2_t acc = vdupq_n_u64(0);
+  for (; i + 8 <= count; i += 8) {
+    int16x8_t v = vld1q_s16(&samples[i]);
+    int32x4_t lo = vmull_s16(vget_low_s16(v), vget_low_s16(v));
+    int32x4_t hi = vmull_s16(vget_high_s16(v), vget_high_s16(v));
+    acc = vpadalq_u32(acc, vreinterpretq_u32_s32(lo));
+    acc = vpadalq_u32(acc, vreinterpretq_u32_s32(hi));
+  }
+  sum = vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1);
+#endif
+
+  for (; i < count; i++) {
+    int32_t s = samples[i];
+    sum += (uint64_t)(s * s);
+  }
+  return sum;
+}
+
+double AudioUtils::GetLevelDb(const int16_t *samples, size_t count)
+{
+  if (count == 0) {
+    return AUDIO_LEVEL_MIN_DB;
+  }
+
+  uint64_t sum = SumOfSquares(samples, count);
+  if (sum == 0) {
+    return AUDIO_LEVEL_MIN_DB;
+  }
+
+  // 32768 を 0 dBFS とします。
+  double meanSquare = (double)sum / count / (32768.0 * 32768.0);
+  double db = 10.0 * log10(meanSquare);
+  return (db < AUDIO_LEVEL_MIN_DB) ? AUDIO_LEVEL_MIN_DB : db;
+}
+
+float AudioUtils::DotProduct(const float *a, const float *b, size_t count)
+{
+  float sum = 0.0f;
+  size_t i = 0;
+
+#if defined(__AVX__)
+  __m256 acc = _mm256_setzero_ps();
+  for (; i + 8 <= count; i += 8) {
+#if defined(__FMA__)
+    acc = _mm256_fmadd_ps(_mm256_loadu_ps(&a[i]), _mm256_loadu_ps(&b[i]), acc);
+#else
+    acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(&a[i]), _mm256_loadu_ps(&b[i])));
+#endif
+  }
+  __m128 acc4 = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+  for (; i + 4 <= count; i += 4) {
+    acc4 = _mm_add_ps(acc4, _mm_mul_ps(_mm_loadu_ps(&a[i]), _mm_loadu_ps(&b[i])));
+  }
+  float lanes[4];
+  _mm_storeu_ps(lanes, acc4);
+  sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(__SSE2__)
+  __m128 acc = _mm_setzero_ps();
+  for (; i + 4 <= count; i += 4) {
+    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(&a[i]), _mm_loadu_ps(&b[i])));
+  }
+  float lanes[4];
+  _mm_storeu_ps(lanes, acc);
+  sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(__ARM_NEON)
+  float32x4_t acc = vdupq_n_f32(0.0f);
+  for (; i + 4 <= count; i += 4) {
+    acc = vmlaq_f32(acc, vld1q_f32(&a[i]), vld1q_f32(&b[i]));
+  }
+  sum = (vgetq_lane_f32(acc, 0) + vgetq_lane_f32(acc, 1)) + (vgetq_lane_f32(acc, 2) + vgetq_lane_f32(acc, 3));
+#endif
+
+  for (; i < count; i++) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+class AudioUtils {
+private:
+  AudioUtils() {}
+  ~AudioUtils() {}
+
+public:
+  // PCM サンプルの二乗和を計算します。
+  // SSE2 または NEON が使える場合には、8 サンプルずつまとめて計算します。
+  static uint64_t SumOfSquares(const int16_t *samples, size_t count);
+
+  // PCM サンプルの RMS を dBFS で返します。無音の場合には -100 を返します。
+  static double GetLevelDb(const int16_t *samples, size_t count);
+
+  // 内積を計算します。
+  // AVX、SSE2 または NEON が使える場合には、8 または 4 要素ずつまとめて計算します。
+  static float DotProduct(const float *a, const float *b, size_t count);
+};
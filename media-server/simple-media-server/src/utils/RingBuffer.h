@@ -0,0 +1,117 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+// 固定長のリングバッファです。
+//
+// バッファの後ろに maxChunk 分の領域 (ミラー) を確保して、先頭の maxChunk 分と同じ内容を
+// 保持しておくことで、書き込みと読み出しのどちらも折り返しを意識せずに連続した領域として扱えます。
+// デコーダに直接書き込ませたり、エンコーダに直接読み出させたりするために使用します。
+//
+// 1 回に書き込み、読み出しできるのは maxChunk までです。
+// スレッドセーフではないので、同じスレッドから使用してください。
+template<typename T>
+class RingBuffer {
+private:
+  std::vector<T> mBuffer;
+  uint32_t mCapacity;
+  uint32_t mMaxChunk;
+  uint32_t mReadPos;
+  uint32_t mWritePos;
+  uint32_t mSize;
+
+public:
+  RingBuffer() {
+    mCapacity = 0;
+    mMaxChunk = 0;
+    mReadPos = 0;
+    mWritePos = 0;
+    mSize = 0;
+  }
+
+  ~RingBuffer() {
+  }
+
+  // capacity には保持できる要素数を、maxChunk には 1 回に書き込み、読み出しする最大の要素数を指定します。
+  void init(uint32_t capacity, uint32_t maxChunk) {
+    if (capacity < maxChunk) {
+      capacity = maxChunk;
+    }
+    mCapacity = capacity;
+    mMaxChunk = maxChunk;
+    mBuffer.assign(capacity + maxChunk, 0);
+    clear();
+  }
+
+  void clear() {
+    mReadPos = 0;
+    mWritePos = 0;
+    mSize = 0;
+  }
+
+  // 保持している要素数
+  uint32_t size() const {
+    return mSize;
+  }
+
+  // 書き込める要素数
+  uint32_t available() const {
+    return mCapacity - mSize;
+  }
+
+  uint32_t getMaxChunk() const {
+    return mMaxChunk;
+  }
+
+  // 書き込み先の先頭を返します。maxChunk まで連続して書き込めます。
+  // 書き込んだ後に commit を呼び出してください。
+  T *getWriteBuffer() {
+    return &mBuffer[mWritePos];
+  }
+
+  // getWriteBuffer に書き込んだ count 個の要素を追加します。
+  // 空きが足りない場合には、古い要素を破棄して、破棄した要素数を返します。
+  uint32_t commit(uint32_t count) {
+    if (count > mMaxChunk) {
+      count = mMaxChunk;
+    }
+
+    uint32_t end = mWritePos + count;
+    // ミラー領域にはみ出した分は先頭に書き戻します。
+    if (end > mCapacity) {
+      memcpy(&mBuffer[0], &mBuffer[mCapacity], (end - mCapacity) * sizeof(T));
+    }
+    // 先頭の maxChunk 分に書き込んだ分はミラー領域にも書き込みます。
+    if (mWritePos < mMaxChunk) {
+      uint32_t mirrorEnd = (end < mMaxChunk) ? end : mMaxChunk;
+      memcpy(&mBuffer[mCapacity + mWritePos], &mBuffer[mWritePos], (mirrorEnd - mWritePos) * sizeof(T));
+    }
+
+    mWritePos = end % mCapacity;
+    uint32_t dropped = 0;
+    if (mSize + count > mCapacity) {
+      dropped = mSize + count - mCapacity;
+      mReadPos = (mReadPos + dropped) % mCapacity;
+      mSize = mCapacity;
+    } else {
+      mSize += count;
+    }
+    return dropped;
+  }
+
+  // 読み出し位置の先頭を返します。maxChunk までは連続した領域として読み出せます。
+  const T *getReadBuffer() const {
+    return &mBuffer[mReadPos];
+  }
+
+  // count 個の要素を読み出し済みにします。
+  void consume(uint32_t count) {
+    if (count > mSize) {
+      count = mSize;
+    }
+    mReadPos = (mReadPos + count) % mCapacity;
+    mSize -= count;
+  }
+};
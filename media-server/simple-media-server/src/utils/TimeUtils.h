@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+
+class TimeUtils {
+private:
+  TimeUtils() {}
+  ~TimeUtils() {}
+
+public:
+  // 単調増加する時刻をマイクロ秒で取得します。
+  static inline uint64_t GetMonotonicTimeUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  // 単調増加する時刻をミリ秒で取得します。
+  static inline uint64_t GetMonotonicTimeMs() {
+    return GetMonotonicTimeUs() / 1000;
+  }
+
+  // UNIX 時間をマイクロ秒で取得します。
+  static inline uint64_t GetWallClockTimeUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+  }
+
+  // UNIX 時間 (マイクロ秒) を 64 bit の NTP タイムスタンプに変換します。
+  // 上位 32 bit が 1900 年からの秒数、下位 32 bit が秒未満の値になります。
+  static inline uint64_t ToNtpTime(uint64_t wallClockTimeUs) {
+    uint64_t seconds = wallClockTimeUs / 1000000 + 2208988800ULL;
+    uint64_t fraction = ((wallClockTimeUs % 1000000) << 32) / 1000000;
+    return (seconds << 32) | fraction;
+  }
+};
@@ -1,7 +1,7 @@
 import { WebsocketClient, WSClientEvent } from "./websocket-client";
 import { MediasoupManager, DEFAULT_MEDIASOUP_ID } from "./mediasoup-manager";
 import { getLogger } from "log4js";
-import { Mediasoup } from "./mediasoup";
+import { Mediasoup, MediasoupEvent } from "./mediasoup";
 import { MCError } from "./mediasoup-error";
 
 const defaultLogger = getLogger();
@@ -14,6 +14,10 @@ export class MediasoupClient {
   private client:WebsocketClient;
   private transports:Map<string, any> = new Map();
   private funcMap:Map<string, MediasoupFunction> = new Map();
+  // このクライアントが作成した Producer と、Consumer の数を通知する Mediasoup
+  private producerIds:Set<string> = new Set();
+  private listeningMediasoups:Set<Mediasoup> = new Set();
+  private consumerCountListener = this.onConsumerCount.bind(this);
 
   constructor(manager:MediasoupManager, client:WebsocketClient) {
     this.manager = manager;
@@ -69,6 +73,28 @@ export class MediasoupClient {
       }
     }
     this.transports.clear();
+
+    for (const listening of this.listeningMediasoups) {
+      listening.off(MediasoupEvent.KEY_ON_CONSUMER_COUNT, this.consumerCountListener);
+    }
+    this.listeningMediasoups.clear();
+    this.producerIds.clear();
+  }
+
+  // このクライアントが作成した Producer の Consumer の数が変わったら通知します。
+  // 通知には uuid を付けて、レスポンスと同じように処理できるようにしています。
+  private onConsumerCount(producerId:string, count:number) : void {
+    if (!this.producerIds.has(producerId)) {
+      return;
+    }
+    this.send({
+      uuid: 'consumerCount',
+      type: 'consumerCount',
+      payload: {
+        producerId: producerId,
+        count: count
+      }
+    });
   }
 
   async onMessage(message:string) {
@@ -294,6 +320,14 @@ export class MediasoupClient {
     if (!producer) {
       throw new MCError('0', 'Failed to create a Producer.');
     }
+    this.producerIds.add(producer.id);
+    producer.observer.on('close', () => {
+      this.producerIds.delete(producer.id);
+    });
+    if (!this.listeningMediasoups.has(mediasoup)) {
+      mediasoup.on(MediasoupEvent.KEY_ON_CONSUMER_COUNT, this.consumerCountListener);
+      this.listeningMediasoups.add(mediasoup);
+    }
     return {
       type: 'produce',
       payload: {
@@ -1,6 +1,7 @@
 import { createWorker, types as mediasoupTypes } from 'mediasoup';
 import { getLogger } from 'log4js';
 import * as fs from 'fs';
+import { EventEmitter } from 'events';
 
 const logger = getLogger();
 
@@ -8,6 +9,11 @@ const logger = getLogger();
 // docker-compose.yml で定義しています。
 const announcedIp = process.env.MEDIASOUP_IP;
 
+export const MediasoupEvent = {
+  // Consumer が作成、削除された時に (producerId, count) で通知します。
+  KEY_ON_CONSUMER_COUNT: 'mediasoup-consumer-count'
+}
+
 export class Mediasoup {
   private id:string;
   private name:string;
@@ -20,6 +26,7 @@ export class Mediasoup {
   private consumers:Map<string, any> = new Map();
   private dataProducers:Map<string, any> = new Map();
   private dataConsumers:Map<string, any> = new Map();
+  private emitter:EventEmitter = new EventEmitter();
 
   constructor(id:string, name:string) {
     this.id = id;
@@ -47,6 +54,14 @@ export class Mediasoup {
     return this.name;
   }
 
+  on(key:string, callback:any) : void {
+    this.emitter.on(key, callback);
+  }
+
+  off(key:string, callback:any) : void {
+    this.emitter.off(key, callback);
+  }
+
   private loadConfig(configPath: string): { 
     workerOptions: mediasoupTypes.WorkerSettings, 
     mediaCodecs: mediasoupTypes.RtpCodecCapability[], 
@@ -217,6 +232,20 @@ export class Mediasoup {
     return this.consumers.get(id);
   }
 
+  getConsumerCount(producerId:string) : number {
+    let count = 0;
+    for (const consumer of this.consumers.values()) {
+      if (consumer.producerId === producerId) {
+        count++;
+      }
+    }
+    return count;
+  }
+
+  private notifyConsumerCount(producerId:string) : void {
+    this.emitter.emit(MediasoupEvent.KEY_ON_CONSUMER_COUNT, producerId, this.getConsumerCount(producerId));
+  }
+
   pauseConsumer(id:string) : void {
     const consumer = this.findConsumer(id);
     if (consumer) {
@@ -252,8 +281,10 @@ export class Mediasoup {
         if (!this.consumers.delete(consumer.id)) {
           logger.warn(`Failed to delete a consumer. id=${consumer.id}`);
         }
+        this.notifyConsumerCount(consumer.producerId);
       });
       this.consumers.set(consumer.id, consumer);
+      this.notifyConsumerCount(consumer.producerId);
       return consumer;
     } catch (e) {
       logger.error(`Failed to create a Consumer. payload:`, payload, e);